@@ -84,7 +84,7 @@ static void reset_channel(struct channel*);
 static bool check_device_type(struct disk*);
 static void identify_ata_device(struct disk*);
 
-static void select_sector(struct disk*, disk_sector_t);
+static void select_sectors(struct disk*, disk_sector_t, size_t);
 static void issue_pio_command(struct channel*, uint8_t command);
 static void input_sector(struct channel*, void*);
 static void output_sector(struct channel*, const void*);
@@ -120,6 +120,7 @@ void disk_init(void) {
             default: NOT_REACHED();
         }
         lock_init(&c->lock);
+        lock_set_name(&c->lock, c->name);
         c->expecting_interrupt = false;
         sema_init(&c->completion_wait, 0);
 
@@ -208,20 +209,39 @@ disk_sector_t disk_size(struct disk* d) {
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 void disk_read(struct disk* d, disk_sector_t sec_no, void* buffer) {
+    disk_read_multiple(d, sec_no, buffer, 1);
+}
+
+/* Reads CNT sectors, starting at SEC_NO, from disk D into
+   BUFFER, which must have room for CNT * DISK_SECTOR_SIZE bytes.
+   CNT must be between 1 and DISK_MULTIPLE_MAX.  The sectors are
+   read with a single command, which costs much less than reading
+   them one by one.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void disk_read_multiple(struct disk* d, disk_sector_t sec_no, void* buffer,
+                        size_t cnt) {
     struct channel* c;
+    uint8_t* p = buffer;
+    size_t i;
 
     ASSERT(d != NULL);
     ASSERT(buffer != NULL);
 
     c = d->channel;
     lock_acquire(&c->lock);
-    select_sector(d, sec_no);
+    select_sectors(d, sec_no, cnt);
     issue_pio_command(c, CMD_READ_SECTOR_RETRY);
-    sema_down(&c->completion_wait);
-    if (!wait_while_busy(d))
-        PANIC("%s: disk read failed, sector=%" PRDSNu, d->name, sec_no);
-    input_sector(c, buffer);
-    d->read_cnt++;
+    for (i = 0; i < cnt; i++, p += DISK_SECTOR_SIZE)
+    {
+        /* The disk interrupts as each sector becomes ready. */
+        sema_down(&c->completion_wait);
+        if (!wait_while_busy(d))
+            PANIC("%s: disk read failed, sector=%" PRDSNu, d->name,
+                  sec_no + (disk_sector_t)i);
+        input_sector(c, p);
+    }
+    d->read_cnt += cnt;
     lock_release(&c->lock);
 }
 
@@ -231,20 +251,42 @@ void disk_read(struct disk* d, disk_sector_t sec_no, void* buffer) {
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 void disk_write(struct disk* d, disk_sector_t sec_no, const void* buffer) {
+    disk_write_multiple(d, sec_no, buffer, 1);
+}
+
+/* Writes CNT sectors, starting at SEC_NO, to disk D from BUFFER,
+   which must contain CNT * DISK_SECTOR_SIZE bytes.  CNT must be
+   between 1 and DISK_MULTIPLE_MAX.  The sectors are written with
+   a single command.  Returns after the disk has acknowledged
+   receiving all of the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void disk_write_multiple(struct disk* d, disk_sector_t sec_no,
+                         const void* buffer, size_t cnt) {
     struct channel* c;
+    const uint8_t* p = buffer;
+    size_t i;
 
     ASSERT(d != NULL);
     ASSERT(buffer != NULL);
 
     c = d->channel;
     lock_acquire(&c->lock);
-    select_sector(d, sec_no);
+    select_sectors(d, sec_no, cnt);
     issue_pio_command(c, CMD_WRITE_SECTOR_RETRY);
-    if (!wait_while_busy(d))
-        PANIC("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no);
-    output_sector(c, buffer);
+    for (i = 0; i < cnt; i++, p += DISK_SECTOR_SIZE)
+    {
+        /* The disk asks for the first sector right away, and for
+           each of the others with an interrupt after taking the
+           one before. */
+        if (i > 0) sema_down(&c->completion_wait);
+        if (!wait_while_busy(d))
+            PANIC("%s: disk write failed, sector=%" PRDSNu, d->name,
+                  sec_no + (disk_sector_t)i);
+        output_sector(c, p);
+    }
     sema_down(&c->completion_wait);
-    d->write_cnt++;
+    d->write_cnt += cnt;
     lock_release(&c->lock);
 }
 
@@ -402,16 +444,17 @@ static void print_ata_string(char* string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
-static void select_sector(struct disk* d, disk_sector_t sec_no) {
+   writes SEC_NO and CNT to the disk's sector selection and sector
+   count registers.  (We use LBA mode.) */
+static void select_sectors(struct disk* d, disk_sector_t sec_no, size_t cnt) {
     struct channel* c = d->channel;
 
-    ASSERT(sec_no < d->capacity);
-    ASSERT(sec_no < (1UL << 28));
+    ASSERT(cnt > 0 && cnt <= DISK_MULTIPLE_MAX);
+    ASSERT(sec_no < d->capacity && cnt <= d->capacity - sec_no);
+    ASSERT(sec_no + cnt <= (1UL << 28));
 
     select_device_wait(d);
-    outb(reg_nsect(c), 1);
+    outb(reg_nsect(c), cnt);
     outb(reg_lbal(c), sec_no);
     outb(reg_lbam(c), sec_no >> 8);
     outb(reg_lbah(c), (sec_no >> 16));
@@ -4,25 +4,40 @@
 
 static int next(int pos);
 static void wait(struct intq* q, struct thread** waiter);
-static void signal(struct intq* q, struct thread** waiter);
+static struct thread* signal(struct intq* q, struct thread** waiter);
 
 /* Initializes interrupt queue Q. */
 void intq_init(struct intq* q) {
+    spin_init(&q->spin);
     lock_init(&q->lock);
     q->not_full = q->not_empty = NULL;
     q->head = q->tail = 0;
 }
 
-/* Returns true if Q is empty, false otherwise. */
-bool intq_empty(const struct intq* q) {
+/* Returns true if Q is empty, false otherwise.  Unless the
+   caller alone adds to Q, it may not be empty any more by the
+   time this returns. */
+bool intq_empty(struct intq* q) {
+    bool empty;
+
     ASSERT(intr_get_level() == INTR_OFF);
-    return q->head == q->tail;
+    spin_lock(&q->spin);
+    empty = q->head == q->tail;
+    spin_unlock(&q->spin);
+    return empty;
 }
 
-/* Returns true if Q is full, false otherwise. */
-bool intq_full(const struct intq* q) {
+/* Returns true if Q is full, false otherwise.  Unless the caller
+   alone removes from Q, it may not be full any more by the time
+   this returns. */
+bool intq_full(struct intq* q) {
+    bool full;
+
     ASSERT(intr_get_level() == INTR_OFF);
-    return next(q->head) == q->tail;
+    spin_lock(&q->spin);
+    full = next(q->head) == q->tail;
+    spin_unlock(&q->spin);
+    return full;
 }
 
 /* Removes a byte from Q and returns it.
@@ -30,20 +45,28 @@ bool intq_full(const struct intq* q) {
    Otherwise, if Q is empty, first sleeps until a byte is
    added. */
 uint8_t intq_getc(struct intq* q) {
+    struct thread* wake;
     uint8_t byte;
 
     ASSERT(intr_get_level() == INTR_OFF);
-    while (intq_empty(q))
+    spin_lock(&q->spin);
+    while (q->head == q->tail)
     {
         ASSERT(!intr_context());
+        spin_unlock(&q->spin);
         lock_acquire(&q->lock);
+        spin_lock(&q->spin);
         wait(q, &q->not_empty);
         lock_release(&q->lock);
+        spin_lock(&q->spin);
     }
 
     byte = q->buf[q->tail];
     q->tail = next(q->tail);
-    signal(q, &q->not_full);
+    wake = signal(q, &q->not_full);
+    spin_unlock(&q->spin);
+
+    if (wake != NULL) thread_unblock(wake);
     return byte;
 }
 
@@ -52,47 +75,72 @@ uint8_t intq_getc(struct intq* q) {
    Otherwise, if Q is full, first sleeps until a byte is
    removed. */
 void intq_putc(struct intq* q, uint8_t byte) {
+    struct thread* wake;
+
     ASSERT(intr_get_level() == INTR_OFF);
-    while (intq_full(q))
+    spin_lock(&q->spin);
+    while (next(q->head) == q->tail)
     {
         ASSERT(!intr_context());
+        spin_unlock(&q->spin);
         lock_acquire(&q->lock);
+        spin_lock(&q->spin);
         wait(q, &q->not_full);
         lock_release(&q->lock);
+        spin_lock(&q->spin);
     }
 
     q->buf[q->head] = byte;
     q->head = next(q->head);
-    signal(q, &q->not_empty);
+    wake = signal(q, &q->not_empty);
+    spin_unlock(&q->spin);
+
+    if (wake != NULL) thread_unblock(wake);
 }
 
 /* Returns the position after POS within an intq. */
 static int next(int pos) { return (pos + 1) % INTQ_BUFSIZE; }
 
 /* WAITER must be the address of Q's not_empty or not_full
-   member.  Waits until the given condition is true. */
-static void wait(struct intq* q UNUSED, struct thread** waiter) {
+   member, and Q's spinlock must be held.  Waits until the given
+   condition is true, unless it already is.  Releases the
+   spinlock in either case. */
+static void wait(struct intq* q, struct thread** waiter) {
+    bool ready;
+
     ASSERT(!intr_context());
     ASSERT(intr_get_level() == INTR_OFF);
-    ASSERT((waiter == &q->not_empty && intq_empty(q)) ||
-           (waiter == &q->not_full && intq_full(q)));
+    ASSERT(waiter == &q->not_empty || waiter == &q->not_full);
+
+    /* The condition may have come true while we waited for Q's
+       lock. */
+    if (waiter == &q->not_empty)
+        ready = q->head != q->tail;
+    else
+        ready = next(q->head) != q->tail;
+    if (ready)
+    {
+        spin_unlock(&q->spin);
+        return;
+    }
 
     *waiter = thread_current();
-    thread_block();
+    thread_block_locked(&q->spin);
 }
 
 /* WAITER must be the address of Q's not_empty or not_full
-   member, and the associated condition must be true.  If a
-   thread is waiting for the condition, wakes it up and resets
-   the waiting thread. */
-static void signal(struct intq* q UNUSED, struct thread** waiter) {
+   member, the associated condition must be true, and Q's
+   spinlock must be held.  If a thread is waiting for the
+   condition, resets the waiting thread and returns it, so that
+   the caller may wake it up once it has released the spinlock.
+   Otherwise, returns a null pointer. */
+static struct thread* signal(struct intq* q, struct thread** waiter) {
+    struct thread* t = *waiter;
+
     ASSERT(intr_get_level() == INTR_OFF);
-    ASSERT((waiter == &q->not_empty && !intq_empty(q)) ||
-           (waiter == &q->not_full && !intq_full(q)));
+    ASSERT((waiter == &q->not_empty && q->head != q->tail) ||
+           (waiter == &q->not_full && next(q->head) != q->tail));
 
-    if (*waiter != NULL)
-    {
-        thread_unblock(*waiter);
-        *waiter = NULL;
-    }
+    *waiter = NULL;
+    return t;
 }
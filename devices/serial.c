@@ -54,6 +54,10 @@ static enum { UNINIT, POLL, QUEUE } mode;
 /* Data to be transmitted. */
 static struct intq txq;
 
+/* Serializes access to the UART and to txq among CPUs.  Taken
+   with interrupts off. */
+static struct spinlock serial_lock;
+
 static void set_serial(int bps);
 static void putc_poll(uint8_t);
 static void write_ier(void);
@@ -85,7 +89,9 @@ void serial_init_queue(void) {
     intr_register_ext(0x20 + 4, serial_interrupt, "serial");
     mode = QUEUE;
     old_level = intr_disable();
+    spin_lock(&serial_lock);
     write_ier();
+    spin_unlock(&serial_lock);
     intr_set_level(old_level);
 }
 
@@ -93,6 +99,7 @@ void serial_init_queue(void) {
 void serial_putc(uint8_t byte) {
     enum intr_level old_level = intr_disable();
 
+    spin_lock(&serial_lock);
     if (mode != QUEUE)
     {
         /* If we're not set up for interrupt-driven I/O yet,
@@ -104,19 +111,20 @@ void serial_putc(uint8_t byte) {
     {
         /* Otherwise, queue a byte and update the interrupt enable
            register. */
-        if (old_level == INTR_OFF && intq_full(&txq))
+        if (intq_full(&txq))
         {
-            /* Interrupts are off and the transmit queue is full.
-               If we wanted to wait for the queue to empty,
-               we'd have to reenable interrupts.
-               That's impolite, so we'll send a character via
-               polling instead. */
+            /* The transmit queue is full.  If we wanted to wait
+               for the queue to empty, we'd have to release
+               serial_lock and maybe reenable interrupts.  That's
+               impolite, so we'll send a character via polling
+               instead. */
             putc_poll(intq_getc(&txq));
         }
 
         intq_putc(&txq, byte);
         write_ier();
     }
+    spin_unlock(&serial_lock);
 
     intr_set_level(old_level);
 }
@@ -125,7 +133,9 @@ void serial_putc(uint8_t byte) {
    mode. */
 void serial_flush(void) {
     enum intr_level old_level = intr_disable();
+    spin_lock(&serial_lock);
     while (!intq_empty(&txq)) putc_poll(intq_getc(&txq));
+    spin_unlock(&serial_lock);
     intr_set_level(old_level);
 }
 
@@ -135,7 +145,12 @@ void serial_flush(void) {
    to or removed from the buffer. */
 void serial_notify(void) {
     ASSERT(intr_get_level() == INTR_OFF);
-    if (mode == QUEUE) write_ier();
+    if (mode == QUEUE)
+    {
+        spin_lock(&serial_lock);
+        write_ier();
+        spin_unlock(&serial_lock);
+    }
 }
 
 /* Configures the serial port for BPS bits per second. */
@@ -156,7 +171,7 @@ static void set_serial(int bps) {
     outb(LCR_REG, LCR_N81);
 }
 
-/* Update interrupt enable register. */
+/* Update interrupt enable register.  serial_lock must be held. */
 static void write_ier(void) {
     uint8_t ier = 0;
 
@@ -189,15 +204,18 @@ static void serial_interrupt(struct intr_frame* f UNUSED) {
     inb(IIR_REG);
 
     /* As long as we have room to receive a byte, and the hardware
-       has a byte for us, receive a byte.  */
+       has a byte for us, receive a byte.  This is done without
+       serial_lock, because input_putc() calls serial_notify(). */
     while (!input_full() && (inb(LSR_REG) & LSR_DR) != 0)
         input_putc(inb(RBR_REG));
 
     /* As long as we have a byte to transmit, and the hardware is
        ready to accept a byte for transmission, transmit a byte. */
+    spin_lock(&serial_lock);
     while (!intq_empty(&txq) && (inb(LSR_REG) & LSR_THRE) != 0)
         outb(THR_REG, intq_getc(&txq));
 
     /* Update interrupt enable register based on queue status. */
     write_ier();
+    spin_unlock(&serial_lock);
 }
@@ -17,13 +17,67 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
+/* 8254 input frequency. */
+#define PIT_HZ 1193180
+
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* PIT count for one timer tick in periodic mode. */
+static uint16_t tick_count;
+
+/* Dynamic ticks.  While the idle thread halts with nothing
+   runnable, the PIT is switched from periodic mode into one-shot
+   mode so that it only fires at the next timer deadline.  This
+   is the number of ticks that the pending one-shot stands for,
+   or 0 if the PIT is in periodic mode. */
+static int64_t oneshot_ticks;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Hierarchical timer wheel.
+
+   Pending timers are hashed by expiry tick into one of five
+   levels.  Level 0 (tv1) has one slot per tick for the next
+   TVR_SIZE ticks.  Each higher level covers TVN_SIZE times the
+   span of the level below it, with TVN_SIZE slots of
+   correspondingly coarser granularity.  Adding or cancelling a
+   timer is O(1).  Each tick, the tv1 slot for the current tick
+   is run; whenever tv1 wraps around, the next slot of tv2 is
+   "cascaded", that is, its timers are redistributed into the
+   finer level, and so on upward.  Every timer is cascaded at
+   most once per level, so expiry is amortized O(1) as well.
+
+   wheel_clk is the next tick whose tv1 slot has not been run
+   yet.  Only the timer interrupt advances it.
+
+   Any CPU may add or cancel timers, so the wheel is protected by
+   wheel_lock, taken with interrupts off. */
+#define TVN_BITS 6
+#define TVR_BITS 8
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TV_LEVELS 4 /* Number of coarse levels above tv1. */
+#define MAX_TVAL ((int64_t)((1ULL << (TVR_BITS + TV_LEVELS * TVN_BITS)) - 1))
+
+static struct list tv1[TVR_SIZE];
+static struct list tvn[TV_LEVELS][TVN_SIZE];
+static int64_t wheel_clk;
+static struct spinlock wheel_lock;
+
+static void wheel_add(struct timer*);
+static int64_t wheel_next_event(int64_t limit);
+static void run_timers(int64_t now);
+static void pit_periodic(void);
+static void pit_oneshot(uint16_t count);
+static uint16_t pit_read_count(void);
+static bool pit_fired(void);
+static void wake_sleeper(void* sema_);
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops(unsigned loops);
 static void busy_wait(int64_t loops);
@@ -35,11 +89,15 @@ static void real_time_sleep(int64_t num, int32_t denom);
 void timer_init(void) {
     /* 8254 input frequency divided by TIMER_FREQ, rounded to
        nearest. */
-    uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
+    tick_count = (PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ;
+    oneshot_ticks = 0;
+    pit_periodic();
 
-    outb(0x43, 0x34); /* CW: counter 0, LSB then MSB, mode 2, binary. */
-    outb(0x40, count & 0xff);
-    outb(0x40, count >> 8);
+    for (int i = 0; i < TVR_SIZE; i++) list_init(&tv1[i]);
+    for (int lvl = 0; lvl < TV_LEVELS; lvl++)
+        for (int i = 0; i < TVN_SIZE; i++) list_init(&tvn[lvl][i]);
+    wheel_clk = 0;
+    spin_init(&wheel_lock);
 
     intr_register_ext(0x20, timer_interrupt, "8254 Timer");
 }
@@ -84,16 +142,16 @@ int64_t timer_elapsed(int64_t then) { return timer_ticks() - then; }
 /* Suspends execution for approximately TICKS timer ticks. */
 void timer_sleep(int64_t ticks) {
     int64_t start = timer_ticks();
+    struct semaphore done;
+    struct timer t;
 
     ASSERT(intr_get_level() == INTR_ON);
-    intr_disable();
     if (timer_elapsed(start) < ticks)
     {
-        thread_current()->wakeup_time = start + ticks;
-        insert_sleep_list();
-        thread_block();
+        sema_init(&done, 0);
+        timer_add(&t, start + ticks, wake_sleeper, &done);
+        sema_down(&done);
     }
-    intr_enable();
 }
 
 /* Suspends execution for approximately MS milliseconds. */
@@ -105,6 +163,106 @@ void timer_usleep(int64_t us) { real_time_sleep(us, 1000 * 1000); }
 /* Suspends execution for approximately NS nanoseconds. */
 void timer_nsleep(int64_t ns) { real_time_sleep(ns, 1000 * 1000 * 1000); }
 
+/* Arms timer T to call FUNC(AUX) from the timer interrupt once
+   timer_ticks() reaches EXPIRES.  An EXPIRES that has already
+   passed fires on the next tick.  T must not already be
+   pending. */
+void timer_add(struct timer* t, int64_t expires, timer_func* func, void* aux) {
+    enum intr_level old_level;
+
+    ASSERT(t != NULL);
+    ASSERT(func != NULL);
+
+    old_level = intr_disable();
+    spin_lock(&wheel_lock);
+    t->expires = expires;
+    t->func = func;
+    t->aux = aux;
+    t->pending = true;
+    wheel_add(t);
+    spin_unlock(&wheel_lock);
+    intr_set_level(old_level);
+}
+
+/* Disarms timer T.  Returns true if T was pending, false if it
+   had already fired or been cancelled.  T must have been passed
+   to timer_add() at least once. */
+bool timer_cancel(struct timer* t) {
+    enum intr_level old_level;
+    bool was_pending;
+
+    ASSERT(t != NULL);
+
+    old_level = intr_disable();
+    spin_lock(&wheel_lock);
+    was_pending = t->pending;
+    if (was_pending)
+    {
+        list_remove(&t->elem);
+        t->pending = false;
+    }
+    spin_unlock(&wheel_lock);
+    intr_set_level(old_level);
+
+    return was_pending;
+}
+
+/* Returns true if timer T is armed and has not fired yet. */
+bool timer_pending(const struct timer* t) { return t->pending; }
+
+/* Called by the idle thread, with interrupts off, just before
+   it halts the CPU.  Reprograms the PIT to fire once at the
+   earliest pending timer deadline instead of on every tick, as
+   far as the PIT's 16-bit counter allows. */
+void timer_idle_enter(void) {
+    int64_t max_ticks, next;
+    uint16_t partial;
+
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    /* Still waiting for the one-shot armed by timer_idle_exit(). */
+    if (oneshot_ticks != 0) return;
+
+    /* The first tick is whatever is left of the current one. */
+    partial = pit_read_count();
+    if (partial == 0 || partial > tick_count) return;
+    max_ticks = (UINT16_MAX - partial) / tick_count + 1;
+
+    next = wheel_next_event(ticks + max_ticks);
+    if (next - ticks <= 1) return;
+
+    oneshot_ticks = next - ticks;
+    pit_oneshot(partial + (oneshot_ticks - 1) * tick_count);
+}
+
+/* Called by the idle thread, with interrupts off, once it is
+   running again after timer_idle_enter().  If something other
+   than the one-shot woke the CPU, accounts for the ticks that
+   went by in the meantime and arms the PIT for the next tick
+   boundary, after which it returns to periodic mode. */
+void timer_idle_exit(void) {
+    int64_t ahead;
+    uint16_t remaining;
+
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    /* Already back in periodic mode, or the one-shot interrupt
+       is pending and will do the accounting itself. */
+    if (oneshot_ticks == 0) return;
+    remaining = pit_read_count();
+    if (remaining == 0 || pit_fired()) return;
+
+    ahead = (remaining - 1) / tick_count;
+    ASSERT(ahead < oneshot_ticks);
+    for (int64_t elapsed = oneshot_ticks - 1 - ahead; elapsed > 0; elapsed--)
+    {
+        ticks++;
+        thread_tick();
+    }
+    oneshot_ticks = 1;
+    pit_oneshot(remaining - ahead * tick_count);
+}
+
 /* Prints timer statistics. */
 void timer_print_stats(void) {
     printf("Timer: %" PRId64 " ticks\n", timer_ticks());
@@ -112,9 +270,170 @@ void timer_print_stats(void) {
 
 /* Timer interrupt handler. */
 static void timer_interrupt(struct intr_frame* args UNUSED) {
-    ticks++;
-    thread_tick();
-    awake(ticks);
+    int64_t elapsed = 1;
+
+    /* A one-shot stands for all the ticks skipped while idle. */
+    if (oneshot_ticks != 0)
+    {
+        elapsed = oneshot_ticks;
+        oneshot_ticks = 0;
+        pit_periodic();
+    }
+
+    while (elapsed-- > 0)
+    {
+        ticks++;
+        thread_tick();
+    }
+    run_timers(ticks);
+}
+
+/* Programs PIT counter 0 to interrupt every TICK_COUNT input
+   clocks, that is, TIMER_FREQ times per second. */
+static void pit_periodic(void) {
+    outb(0x43, 0x34); /* CW: counter 0, LSB then MSB, mode 2, binary. */
+    outb(0x40, tick_count & 0xff);
+    outb(0x40, tick_count >> 8);
+}
+
+/* Programs PIT counter 0 to interrupt once, COUNT input clocks
+   from now. */
+static void pit_oneshot(uint16_t count) {
+    outb(0x43, 0x30); /* CW: counter 0, LSB then MSB, mode 0, binary. */
+    outb(0x40, count & 0xff);
+    outb(0x40, count >> 8);
+}
+
+/* Returns the current value of PIT counter 0. */
+static uint16_t pit_read_count(void) {
+    uint8_t lo, hi;
+
+    outb(0x43, 0x00); /* CW: latch counter 0. */
+    lo = inb(0x40);
+    hi = inb(0x40);
+    return (uint16_t)hi << 8 | lo;
+}
+
+/* Returns true if a one-shot on PIT counter 0 has reached
+   terminal count, i.e. its OUT pin has gone high. */
+static bool pit_fired(void) {
+    outb(0x43, 0xe2); /* Read-back: latch status of counter 0. */
+    return (inb(0x40) & 0x80) != 0;
+}
+
+/* Hashes pending timer T into the wheel slot for its expiry.
+   wheel_lock must be held. */
+static void wheel_add(struct timer* t) {
+    int64_t expires = t->expires;
+    int64_t idx = expires - wheel_clk;
+    struct list* slot;
+
+    ASSERT(wheel_lock.locked);
+
+    if (idx < 0)
+    {
+        /* Already due: run it with the next slot. */
+        slot = &tv1[wheel_clk & TVR_MASK];
+    }
+    else if (idx < TVR_SIZE)
+        slot = &tv1[expires & TVR_MASK];
+    else
+    {
+        int lvl;
+
+        /* Timers too far in the future for the wheel are parked
+           in the last slot and re-hashed as the wheel turns. */
+        if (idx > MAX_TVAL)
+        {
+            idx = MAX_TVAL;
+            expires = wheel_clk + idx;
+        }
+        for (lvl = 0; lvl < TV_LEVELS - 1; lvl++)
+            if (idx < 1LL << (TVR_BITS + (lvl + 1) * TVN_BITS)) break;
+        slot = &tvn[lvl][(expires >> (TVR_BITS + lvl * TVN_BITS)) & TVN_MASK];
+    }
+    list_push_back(slot, &t->elem);
+}
+
+/* Moves every timer in slot IDX of coarse level LVL down the
+   wheel.  Returns IDX, so that a zero result tells the caller to
+   cascade the next level as well. */
+static int cascade(int lvl, int idx) {
+    struct list* slot = &tvn[lvl][idx];
+
+    while (!list_empty(slot))
+        wheel_add(list_entry(list_pop_front(slot), struct timer, elem));
+    return idx;
+}
+
+/* Returns the earliest tick at which the wheel has work to do,
+   or LIMIT if that is later than LIMIT.  Only tv1 is searched:
+   anything in a coarser level is cascaded when tv1 wraps, so
+   the wrap-around tick itself counts as work.  Must be called
+   with interrupts off. */
+static int64_t wheel_next_event(int64_t limit) {
+    int64_t clk;
+
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    spin_lock(&wheel_lock);
+    for (clk = wheel_clk; clk < limit; clk++)
+        if ((clk & TVR_MASK) == 0 || !list_empty(&tv1[clk & TVR_MASK]))
+            break;
+    spin_unlock(&wheel_lock);
+    return clk;
+}
+
+/* Runs all timers that expire at or before tick NOW. */
+static void run_timers(int64_t now) {
+    ASSERT(intr_context());
+
+    spin_lock(&wheel_lock);
+    while (wheel_clk <= now)
+    {
+        int idx = wheel_clk & TVR_MASK;
+        struct list expired;
+        int lvl;
+
+        /* On wrap-around of a level, pull the next slot of the
+           coarser level down into it. */
+        if (idx == 0)
+            for (lvl = 0; lvl < TV_LEVELS; lvl++)
+                if (cascade(lvl, (wheel_clk >> (TVR_BITS + lvl * TVN_BITS)) &
+                                     TVN_MASK) != 0)
+                    break;
+
+        /* Detach the slot first, so that callbacks may re-arm
+           their timers.  A timer in EXPIRED may still be
+           cancelled, from under wheel_lock, until it is run.
+           Callbacks run without the lock, and a timer may be
+           re-armed or freed as soon as it is no longer pending,
+           so it is not touched after that. */
+        list_init(&expired);
+        while (!list_empty(&tv1[idx]))
+            list_push_back(&expired, list_pop_front(&tv1[idx]));
+        wheel_clk++;
+
+        while (!list_empty(&expired))
+        {
+            struct timer* t =
+                list_entry(list_pop_front(&expired), struct timer, elem);
+            timer_func* func = t->func;
+            void* aux = t->aux;
+
+            t->pending = false;
+            spin_unlock(&wheel_lock);
+            func(aux);
+            spin_lock(&wheel_lock);
+        }
+    }
+    spin_unlock(&wheel_lock);
+}
+
+/* Timer callback for timer_sleep(): wakes up the thread sleeping
+   on semaphore SEMA_. */
+static void wake_sleeper(void* sema_) {
+    sema_up(sema_);
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
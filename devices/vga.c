@@ -5,6 +5,7 @@
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* VGA text screen support.  See [FREEVGA] for more information. */
@@ -17,6 +18,9 @@
    the display. */
 static size_t cx, cy;
 
+/* Keeps other CPUs out of the display and cursor. */
+static struct spinlock vga_lock;
+
 /* Attribute value for gray text on a black background. */
 #define GRAY_ON_BLACK 0x07
 
@@ -50,6 +54,7 @@ void vga_putc(int c) {
        that might write to the console. */
     enum intr_level old_level = intr_disable();
 
+    spin_lock(&vga_lock);
     init();
 
     switch (c)
@@ -79,6 +84,7 @@ void vga_putc(int c) {
     /* Update cursor position. */
     move_cursor();
 
+    spin_unlock(&vga_lock);
     intr_set_level(old_level);
 }
 
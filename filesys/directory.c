@@ -4,7 +4,8 @@
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir {
@@ -19,6 +20,22 @@ struct dir_entry {
     bool in_use;                /* In use or free? */
 };
 
+/* Protects the contents of every directory.  Lookups and
+ * readdir only read entries and may run concurrently; adding
+ * and removing entries excludes them. */
+static struct rwlock dir_lock;
+
+/* Cache of `struct dir's. */
+static struct kmem_cache* dir_cache;
+
+/* Initializes the directory module. */
+void dir_init(void) {
+    dir_cache = kmem_cache_create("dir", sizeof(struct dir), 0, NULL);
+    if (dir_cache == NULL) PANIC("out of memory for the directory cache");
+    rwlock_init(&dir_lock);
+    lock_set_name(&dir_lock.lock, "directories");
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool dir_create(disk_sector_t sector, size_t entry_cnt) {
@@ -28,7 +45,7 @@ bool dir_create(disk_sector_t sector, size_t entry_cnt) {
 /* Opens and returns the directory for the given INODE, of which
  * it takes ownership.  Returns a null pointer on failure. */
 struct dir* dir_open(struct inode* inode) {
-    struct dir* dir = calloc(1, sizeof *dir);
+    struct dir* dir = kmem_cache_alloc(dir_cache);
     if (inode != NULL && dir != NULL)
     {
         dir->inode = inode;
@@ -38,7 +55,7 @@ struct dir* dir_open(struct inode* inode) {
     else
     {
         inode_close(inode);
-        free(dir);
+        kmem_cache_free(dir_cache, dir);
         return NULL;
     }
 }
@@ -60,7 +77,7 @@ void dir_close(struct dir* dir) {
     if (dir != NULL)
     {
         inode_close(dir->inode);
-        free(dir);
+        kmem_cache_free(dir_cache, dir);
     }
 }
 
@@ -103,10 +120,12 @@ bool dir_lookup(const struct dir* dir, const char* name, struct inode** inode) {
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
 
+    rwlock_read_acquire(&dir_lock);
     if (lookup(dir, name, &e, NULL))
         *inode = inode_open(e.inode_sector);
     else
         *inode = NULL;
+    rwlock_read_release(&dir_lock);
 
     return *inode != NULL;
 }
@@ -128,6 +147,8 @@ bool dir_add(struct dir* dir, const char* name, disk_sector_t inode_sector) {
     /* Check NAME for validity. */
     if (*name == '\0' || strlen(name) > NAME_MAX) return false;
 
+    rwlock_write_acquire(&dir_lock);
+
     /* Check that NAME is not in use. */
     if (lookup(dir, name, NULL, NULL)) goto done;
 
@@ -149,6 +170,7 @@ bool dir_add(struct dir* dir, const char* name, disk_sector_t inode_sector) {
     success = inode_write_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
 
 done:
+    rwlock_write_release(&dir_lock);
     return success;
 }
 
@@ -164,6 +186,8 @@ bool dir_remove(struct dir* dir, const char* name) {
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
 
+    rwlock_write_acquire(&dir_lock);
+
     /* Find directory entry. */
     if (!lookup(dir, name, &e, &ofs)) goto done;
 
@@ -180,6 +204,7 @@ bool dir_remove(struct dir* dir, const char* name) {
     success = true;
 
 done:
+    rwlock_write_release(&dir_lock);
     inode_close(inode);
     return success;
 }
@@ -189,15 +214,19 @@ done:
  * contains no more entries. */
 bool dir_readdir(struct dir* dir, char name[NAME_MAX + 1]) {
     struct dir_entry e;
+    bool found = false;
 
+    rwlock_read_acquire(&dir_lock);
     while (inode_read_at(dir->inode, &e, sizeof e, dir->pos) == sizeof e)
     {
         dir->pos += sizeof e;
         if (e.in_use)
         {
             strlcpy(name, e.name, NAME_MAX + 1);
-            return true;
+            found = true;
+            break;
         }
     }
-    return false;
+    rwlock_read_release(&dir_lock);
+    return found;
 }
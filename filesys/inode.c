@@ -5,7 +5,10 @@
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -48,11 +51,39 @@ static disk_sector_t byte_to_sector(const struct inode* inode, off_t pos) {
 }
 
 /* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
+ * returns the same `struct inode'.
+ * Opening an inode that is already open only reads the list, so
+ * it is protected by a readers-writer lock.  Open counts are
+ * changed with interrupts off, because readers of the list and
+ * inode_reopen() may change them concurrently. */
 static struct list open_inodes;
+static struct rwlock open_inodes_lock;
+
+/* Cache of `struct inode's. */
+static struct kmem_cache* inode_cache;
 
 /* Initializes the inode module. */
-void inode_init(void) { list_init(&open_inodes); }
+void inode_init(void) {
+    inode_cache = kmem_cache_create("inode", sizeof(struct inode), 0, NULL);
+    if (inode_cache == NULL) PANIC("out of memory for the inode cache");
+    list_init(&open_inodes);
+    rwlock_init(&open_inodes_lock);
+    lock_set_name(&open_inodes_lock.lock, "open inodes");
+}
+
+/* Returns the open inode for SECTOR, reopened, or a null pointer
+ * if there is none.  OPEN_INODES_LOCK must be held. */
+static struct inode* find_open_inode(disk_sector_t sector) {
+    struct list_elem* e;
+
+    for (e = list_begin(&open_inodes); e != list_end(&open_inodes);
+         e = list_next(e))
+    {
+        struct inode* inode = list_entry(e, struct inode, elem);
+        if (inode->sector == sector) return inode_reopen(inode);
+    }
+    return NULL;
+}
 
 /* Initializes an inode with LENGTH bytes of data and
  * writes the new inode to sector SECTOR on the file system
@@ -97,38 +128,48 @@ bool inode_create(disk_sector_t sector, off_t length) {
  * and returns a `struct inode' that contains it.
  * Returns a null pointer if memory allocation fails. */
 struct inode* inode_open(disk_sector_t sector) {
-    struct list_elem* e;
     struct inode* inode;
+    struct inode* other;
 
     /* Check whether this inode is already open. */
-    for (e = list_begin(&open_inodes); e != list_end(&open_inodes);
-         e = list_next(e))
-    {
-        inode = list_entry(e, struct inode, elem);
-        if (inode->sector == sector)
-        {
-            inode_reopen(inode);
-            return inode;
-        }
-    }
+    rwlock_read_acquire(&open_inodes_lock);
+    inode = find_open_inode(sector);
+    rwlock_read_release(&open_inodes_lock);
+    if (inode != NULL) return inode;
 
     /* Allocate memory. */
-    inode = malloc(sizeof *inode);
+    inode = kmem_cache_alloc(inode_cache);
     if (inode == NULL) return NULL;
 
     /* Initialize. */
-    list_push_front(&open_inodes, &inode->elem);
     inode->sector = sector;
     inode->open_cnt = 1;
     inode->deny_write_cnt = 0;
     inode->removed = false;
     disk_read(filesys_disk, inode->sector, &inode->data);
+
+    /* Someone else may have opened it while we were reading. */
+    rwlock_write_acquire(&open_inodes_lock);
+    other = find_open_inode(sector);
+    if (other == NULL) list_push_front(&open_inodes, &inode->elem);
+    rwlock_write_release(&open_inodes_lock);
+
+    if (other != NULL)
+    {
+        kmem_cache_free(inode_cache, inode);
+        inode = other;
+    }
     return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode* inode_reopen(struct inode* inode) {
-    if (inode != NULL) inode->open_cnt++;
+    if (inode != NULL)
+    {
+        enum intr_level old_level = intr_disable();
+        inode->open_cnt++;
+        intr_set_level(old_level);
+    }
     return inode;
 }
 
@@ -141,14 +182,33 @@ disk_sector_t inode_get_inumber(const struct inode* inode) {
  * If this was the last reference to INODE, frees its memory.
  * If INODE was also a removed inode, frees its blocks. */
 void inode_close(struct inode* inode) {
+    enum intr_level old_level;
+    bool last;
+
     /* Ignore null pointer. */
     if (inode == NULL) return;
 
+    /* Dropping a reference that is not the last one does not touch
+     * the inode list. */
+    old_level = intr_disable();
+    last = inode->open_cnt == 1;
+    if (!last) inode->open_cnt--;
+    intr_set_level(old_level);
+    if (!last) return;
+
+    /* Recheck under the list lock, since inode_open() may have
+     * found INODE meanwhile. */
+    rwlock_write_acquire(&open_inodes_lock);
+    old_level = intr_disable();
+    last = --inode->open_cnt == 0;
+    intr_set_level(old_level);
+
     /* Release resources if this was the last opener. */
-    if (--inode->open_cnt == 0)
+    if (last)
     {
         /* Remove from inode list and release lock. */
         list_remove(&inode->elem);
+        rwlock_write_release(&open_inodes_lock);
 
         /* Deallocate blocks if removed. */
         if (inode->removed)
@@ -158,8 +218,10 @@ void inode_close(struct inode* inode) {
                              bytes_to_sectors(inode->data.length));
         }
 
-        free(inode);
+        kmem_cache_free(inode_cache, inode);
     }
+    else
+        rwlock_write_release(&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
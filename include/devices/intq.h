@@ -15,13 +15,17 @@
    and condition variables from threads/synch.h cannot be used in
    this case, as they normally would, because they can only
    protect kernel threads from one another, not from interrupt
-   handlers. */
+   handlers.  The monitor's lock is a spinlock instead, which
+   also keeps out the other CPUs.  A thread that may have to wait
+   must not hold any other spinlock. */
 
 /* Queue buffer size, in bytes. */
 #define INTQ_BUFSIZE 64
 
 /* A circular queue of bytes. */
 struct intq {
+    struct spinlock spin; /* Monitor lock, for the members below. */
+
     /* Waiting threads. */
     struct lock lock;         /* Only one thread may wait at once. */
     struct thread* not_full;  /* Thread waiting for not-full condition. */
@@ -34,8 +38,8 @@ struct intq {
 };
 
 void intq_init(struct intq*);
-bool intq_empty(const struct intq*);
-bool intq_full(const struct intq*);
+bool intq_empty(struct intq*);
+bool intq_full(struct intq*);
 uint8_t intq_getc(struct intq*);
 void intq_putc(struct intq*, uint8_t);
 
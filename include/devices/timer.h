@@ -1,12 +1,30 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* Function called when a timer expires.  Runs in the timer
+   interrupt handler, so it must not sleep. */
+typedef void timer_func(void* aux);
+
+/* A one-shot kernel timer.  Set it up with timer_add(); it fires
+   once at or after tick `expires' unless cancelled first.  The
+   caller owns the storage, which must stay valid until the timer
+   fires or is cancelled. */
+struct timer {
+    int64_t expires;       /* Tick at which FUNC is called. */
+    timer_func* func;      /* Expiry callback. */
+    void* aux;             /* Argument for FUNC. */
+    bool pending;          /* On the timer wheel? */
+    struct list_elem elem; /* Timer wheel slot element. */
+};
+
 void timer_init(void);
 void timer_calibrate(void);
 
@@ -18,6 +36,13 @@ void timer_msleep(int64_t milliseconds);
 void timer_usleep(int64_t microseconds);
 void timer_nsleep(int64_t nanoseconds);
 
+void timer_add(struct timer*, int64_t expires, timer_func*, void* aux);
+bool timer_cancel(struct timer*);
+bool timer_pending(const struct timer*);
+
+void timer_idle_enter(void);
+void timer_idle_exit(void);
+
 void timer_print_stats(void);
 
 #endif /* devices/timer.h */
@@ -111,4 +111,50 @@ __attribute__((always_inline)) static __inline void write_msr(uint32_t ecx,
     __asm __volatile("wrmsr" ::"c"(ecx), "d"(edx), "a"(eax));
 }
 
+__attribute__((always_inline)) static __inline uint64_t read_msr(uint32_t ecx) {
+    uint32_t edx, eax;
+    __asm __volatile("rdmsr" : "=d"(edx), "=a"(eax) : "c"(ecx));
+    return ((uint64_t)edx << 32) | eax;
+}
+
+__attribute__((always_inline)) static __inline uint64_t rcr4(void) {
+    uint64_t val;
+    __asm __volatile("movq %%cr4,%0" : "=r"(val));
+    return val;
+}
+
+__attribute__((always_inline)) static __inline void lcr4(uint64_t val) {
+    __asm __volatile("movq %0, %%cr4" : : "r"(val));
+}
+
+__attribute__((always_inline)) static __inline void cpuid(uint32_t leaf,
+                                                          uint32_t subleaf,
+                                                          uint32_t* eax,
+                                                          uint32_t* ebx,
+                                                          uint32_t* ecx,
+                                                          uint32_t* edx) {
+    __asm __volatile("cpuid"
+                     : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                     : "a"(leaf), "c"(subleaf));
+}
+
+/* Invalidates TLB entries as selected by TYPE for process-context
+   identifier PCID and linear address ADDR.  See [IA32-v2a]
+   "INVPCID--Invalidate Process-Context Identifier". */
+__attribute__((always_inline)) static __inline void invpcid(uint64_t type,
+                                                            uint64_t pcid,
+                                                            uint64_t addr) {
+    struct {
+        uint64_t pcid;
+        uint64_t addr;
+    } desc = {pcid, addr};
+    __asm __volatile("invpcid %0, %1" : : "m"(desc), "r"(type) : "memory");
+}
+
+__attribute__((always_inline)) static __inline uint64_t rdtsc(void) {
+    uint32_t edx, eax;
+    __asm __volatile("rdtsc" : "=d"(edx), "=a"(eax));
+    return ((uint64_t)edx << 32) | eax;
+}
+
 #endif /* intrinsic.h */
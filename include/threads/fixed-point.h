@@ -0,0 +1,41 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* 17.14 fixed-point arithmetic for the 4.4BSD scheduler.
+
+   A fixed_t holds a signed real number X as the integer
+   X * FP_ONE, that is, with 17 bits before and 14 bits after the
+   binary point.  Products and quotients go through 64 bits so
+   that the intermediate values do not overflow. */
+typedef int fixed_t;
+
+#define FP_FRAC_BITS 14
+#define FP_ONE (1 << FP_FRAC_BITS)
+
+/* Converts integer N to fixed point. */
+static inline fixed_t fp_from_int(int n) { return n * FP_ONE; }
+
+/* Converts X to an integer, rounding toward zero. */
+static inline int fp_to_int(fixed_t x) { return x / FP_ONE; }
+
+/* Converts X to an integer, rounding to nearest. */
+static inline int fp_round(fixed_t x) {
+    return x >= 0 ? (x + FP_ONE / 2) / FP_ONE : (x - FP_ONE / 2) / FP_ONE;
+}
+
+/* Returns X + N. */
+static inline fixed_t fp_add_int(fixed_t x, int n) { return x + n * FP_ONE; }
+
+/* Returns X * Y. */
+static inline fixed_t fp_mul(fixed_t x, fixed_t y) {
+    return (fixed_t)((int64_t)x * y / FP_ONE);
+}
+
+/* Returns X / Y. */
+static inline fixed_t fp_div(fixed_t x, fixed_t y) {
+    return (fixed_t)((int64_t)x * FP_ONE / y);
+}
+
+#endif /* threads/fixed-point.h */
@@ -74,6 +74,10 @@ void intr_register_int(uint8_t vec,
                        const char* name);
 bool intr_context(void);
 void intr_yield_on_return(void);
+void intr_wait(void);
+
+void intr_ap_init(void);
+void intr_use_apic(void (*eoi)(int vec));
 
 void intr_dump_frame(const struct intr_frame*);
 const char* intr_name(uint8_t vec);
@@ -3,8 +3,20 @@
 
 #include <debug.h>
 #include <stddef.h>
+#include <stdint.h>
+
+/* Number of freed blocks each thread keeps for reuse. */
+#define MAGAZINE_SIZE 8
+
+/* A thread's cache of freed blocks.  Owned by malloc.c. */
+struct magazine {
+    void* blocks[MAGAZINE_SIZE];     /* Cached blocks. */
+    uint8_t classes[MAGAZINE_SIZE];  /* Size class of each block. */
+    int cnt;                         /* Number of cached blocks. */
+};
 
 void malloc_init(void);
+void malloc_thread_exit(void);
 void* malloc(size_t) __attribute__((malloc));
 void* calloc(size_t, size_t) __attribute__((malloc));
 void* realloc(void*, size_t);
@@ -2,16 +2,33 @@
 #define THREAD_MMU_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "threads/pte.h"
 
 typedef bool pte_for_each_func(uint64_t* pte, void* va, void* aux);
 
+/* Number of pages an mmu_gather frees at a time. */
+#define MMU_GATHER_BATCH 64
+
+/* A batch of unmapped pages whose TLB entries are flushed together,
+   and of pages freed together once they are.  See mmu.c. */
+struct mmu_gather {
+    uint64_t* pml4;                /* Page map being changed. */
+    bool fullmm;                   /* Tearing down all of PML4? */
+    uint64_t start, end;           /* Range of cleared, unflushed pages. */
+    size_t page_cnt;               /* Number of pages to free. */
+    void* pages[MMU_GATHER_BATCH]; /* Pages to free after the flush. */
+};
+
 uint64_t* pml4e_walk(uint64_t* pml4, const uint64_t va, int create);
+uint64_t* pml4_pde_walk(uint64_t* pml4, const uint64_t va, int create);
 uint64_t* pml4_create(void);
 bool pml4_for_each(uint64_t*, pte_for_each_func*, void*);
 void pml4_destroy(uint64_t* pml4);
 void pml4_activate(uint64_t* pml4);
+void pcid_init(void);
+void tlb_flush_all(void);
 void* pml4_get_page(uint64_t* pml4, const void* upage);
 bool pml4_set_page(uint64_t* pml4, void* upage, void* kpage, bool rw);
 void pml4_clear_page(uint64_t* pml4, void* upage);
@@ -20,6 +37,11 @@ void pml4_set_dirty(uint64_t* pml4, const void* upage, bool dirty);
 bool pml4_is_accessed(uint64_t* pml4, const void* upage);
 void pml4_set_accessed(uint64_t* pml4, const void* upage, bool accessed);
 
+void mmu_gather_init(struct mmu_gather*, uint64_t* pml4, bool fullmm);
+void* mmu_gather_clear_page(struct mmu_gather*, void* upage);
+void mmu_gather_free_page(struct mmu_gather*, void* kpage);
+void mmu_gather_finish(struct mmu_gather*);
+
 #define is_writable(pte) (*(pte) & PTE_W)
 #define is_user_pte(pte) (*(pte) & PTE_U)
 #define is_kern_pte(pte) (!is_user_pte(pte))
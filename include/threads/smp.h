@@ -0,0 +1,75 @@
+#ifndef THREADS_SMP_H
+#define THREADS_SMP_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Maximum number of CPUs we bring up. */
+#define CPU_MAX 16
+
+/* Interrupt vectors used by the local APIC. */
+#define VEC_LAPIC_TIMER 0x30 /* Per-CPU scheduler tick on APs. */
+#define VEC_RESCHED 0x31     /* "Look at your run queue" IPI. */
+#define VEC_TLB_FLUSH 0x32   /* "Flush your TLB" IPI. */
+#define VEC_SPURIOUS 0xff    /* Spurious local APIC interrupt. */
+
+/* Threads in THREAD_READY state on one CPU.  There is one FIFO
+   queue per priority level, and bit N of `bitmap' is set iff
+   queues[N] is nonempty, so both enqueue and picking the
+   highest-priority thread are O(1).  `lock' protects the queue
+   and the scheduling state of the threads on it; see thread.c.
+   `charged' lists the threads whose priority the 4.4BSD scheduler
+   must recompute at this CPU's next update. */
+struct run_queue {
+    struct spinlock lock;            /* Protects the members below. */
+    struct list queues[PRI_MAX + 1]; /* One queue per priority. */
+    uint64_t bitmap;                 /* Nonempty queues. */
+    int cnt;                         /* # of threads in all queues. */
+    struct list charged;             /* Threads charged CPU here. */
+};
+
+/* Per-CPU data.
+
+   Each CPU's GS base points to its own struct cpu, whose first
+   member points back to it, so that cpu_current() is a single
+   load that cannot be split by a migration to another CPU. */
+struct cpu {
+    struct cpu* self;          /* This structure. */
+    int id;                    /* Index into cpus[]; 0 is the BSP. */
+    uint8_t apic_id;           /* Local APIC ID. */
+    volatile bool started;     /* Set by the CPU once it is running. */
+
+    /* Interrupt state; see interrupt.c. */
+    bool in_external_intr;     /* Processing an external interrupt? */
+    bool yield_on_return;      /* Should we yield on interrupt return? */
+
+    /* Scheduler state; see thread.c. */
+    struct thread* idle_thread; /* This CPU's idle thread. */
+    struct thread* curr;        /* Thread running on this CPU. */
+    unsigned thread_ticks;      /* # of timer ticks since last yield. */
+    unsigned recalc_ticks;      /* # of timer ticks since the 4.4BSD
+                                   scheduler's last update. */
+    struct run_queue rq;        /* Threads ready to run here. */
+};
+
+extern struct cpu cpus[CPU_MAX];
+extern int cpu_cnt;
+
+/* Returns the CPU we are running on.  Unless interrupts are off,
+   the caller may be migrated to another CPU right afterward. */
+static inline struct cpu* cpu_current(void) {
+    struct cpu* c;
+    asm volatile("movq %%gs:0, %0" : "=r"(c));
+    return c;
+}
+
+void smp_early_init(void);
+void smp_init(void);
+void smp_send_resched(struct cpu*);
+void smp_flush_tlb(void);
+
+#endif /* threads/smp.h */
@@ -0,0 +1,31 @@
+#ifndef THREADS_SWITCH_H
+#define THREADS_SWITCH_H
+
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+
+/* switch_threads()'s stack frame: the callee-saved registers,
+   pushed in this order from the bottom up, and the return
+   address. */
+struct switch_threads_frame {
+    uint64_t r15;
+    uint64_t r14;
+    uint64_t r13;
+    uint64_t r12;
+    uint64_t rbp;
+    uint64_t rbx;
+    void (*rip)(void); /* Return address. */
+};
+
+/* Switches from CUR, which must be the running thread, to NEXT,
+   which must also be running switch_threads(), returning CUR in
+   NEXT's context. */
+struct thread* switch_threads(struct thread* cur, struct thread* next);
+
+/* First code run by a new thread: switch_threads() "returns"
+   here, and it calls the function in rbx with r12, r13 and the
+   thread that switched to it as its three arguments. */
+void switch_entry(void);
+#endif
+
+#endif /* threads/switch.h */
@@ -3,11 +3,29 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+/* Spinlock.
+
+   Busy-waits instead of sleeping, so it may be used where a
+   thread cannot block, such as in interrupt handlers and in the
+   scheduler itself.  It does not disable interrupts; callers
+   that can be interrupted by code taking the same spinlock must
+   do that themselves. */
+struct spinlock {
+    volatile int locked; /* Nonzero while held. */
+};
+
+void spin_init(struct spinlock*);
+void spin_lock(struct spinlock*);
+bool spin_trylock(struct spinlock*);
+void spin_unlock(struct spinlock*);
 
 /* A counting semaphore. */
 struct semaphore {
-    unsigned value;      /* Current value. */
-    struct list waiters; /* List of waiting threads. */
+    struct spinlock lock; /* Protects the members below. */
+    unsigned value;       /* Current value. */
+    struct list waiters;  /* List of waiting threads. */
 };
 
 bool high_priority_sema_first(const struct list_elem* a,
@@ -18,13 +36,33 @@ void sema_init(struct semaphore*, unsigned value);
 void sema_down(struct semaphore*);
 bool sema_try_down(struct semaphore*);
 void sema_up(struct semaphore*);
-void reorder_sema_waiters(struct semaphore* sema);
 void sema_self_test(void);
 
+#ifdef LOCKSTAT
+/* Lock contention statistics, kept when the kernel is built with
+   LOCKSTAT defined.  Times are in TSC cycles. */
+struct lock_stat {
+    const char* name;    /* Set by lock_set_name(), or null. */
+    uint64_t acquired;   /* # of acquisitions. */
+    uint64_t contended;  /* # of acquisitions that had to wait. */
+    uint64_t wait_total; /* Total time spent waiting. */
+    uint64_t wait_max;   /* Longest single wait. */
+    uint64_t hold_total; /* Total time held. */
+};
+#endif
+
 /* Lock. */
 struct lock {
     struct thread* holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    int max_priority;           /* Highest waiter priority, or -1. */
+    struct lock* heap_child;    /* First child in holder's heap. */
+    struct lock* heap_prev;     /* Previous sibling, or parent. */
+    struct lock* heap_next;     /* Next sibling. */
+#ifdef LOCKSTAT
+    struct lock_stat stat;      /* Statistics, if named. */
+    uint64_t acquire_time;      /* When the holder acquired it. */
+#endif
 };
 
 void lock_init(struct lock*);
@@ -32,6 +70,16 @@ void lock_acquire(struct lock*);
 bool lock_try_acquire(struct lock*);
 void lock_release(struct lock*);
 bool lock_held_by_current_thread(const struct lock*);
+void lock_set_base_priority(struct thread*, int priority);
+
+/* Only named locks are reported individually; the rest are
+   lumped together.  Name only locks that are never freed. */
+#ifdef LOCKSTAT
+void lock_set_name(struct lock*, const char* name);
+void lock_print_stats(void);
+#else
+#define lock_set_name(LOCK, NAME) ((void)0)
+#endif
 
 /* Condition variable. */
 struct condition {
@@ -43,6 +91,31 @@ void cond_wait(struct condition*, struct lock*);
 void cond_signal(struct condition*, struct lock*);
 void cond_broadcast(struct condition*, struct lock*);
 
+/* Readers-writer lock.
+
+   Any number of readers or a single writer may hold it.  A writer
+   holds `lock' for its whole critical section, so readers and
+   writers that arrive meanwhile queue on it in priority order and
+   donate their priority to the writer.  A reader holds `lock'
+   only long enough to count itself in, so once a writer is
+   waiting no new reader can get past it and writers are not
+   starved. */
+struct rwlock {
+    struct lock lock;           /* Held by the writer. */
+    struct spinlock count_lock; /* Protects readers and draining. */
+    int readers;                /* # of threads holding it for reading. */
+    bool draining;              /* Writer waiting for readers to leave? */
+    struct semaphore drained;   /* Upped when the last reader leaves. */
+};
+
+void rwlock_init(struct rwlock*);
+void rwlock_read_acquire(struct rwlock*);
+void rwlock_read_release(struct rwlock*);
+void rwlock_write_acquire(struct rwlock*);
+void rwlock_write_release(struct rwlock*);
+void rwlock_downgrade(struct rwlock*);
+bool rwlock_write_held_by_current_thread(const struct rwlock*);
+
 /* Optimization barrier.
  *
  * The compiler will not reorder operations across an
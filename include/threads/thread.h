@@ -4,7 +4,10 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 #ifdef VM
 #include "vm/vm.h"
 #endif
@@ -92,17 +95,29 @@ struct thread {
     int exitStatus;            // exit syscall을 호출할 경우의 상태를 기록
     int priority;              /* Priority. */
     int base_priority;         /* Base priority (before donation). */
-    int64_t wakeup_time;       /* Wake up time */
+    struct cpu* cpu;           /* CPU whose run queue holds us, or the
+                                  CPU we run or last ran on.  Its
+                                  run queue lock protects `status',
+                                  `priority', this member and the
+                                  4.4BSD members below. */
+
+    /* For the 4.4BSD scheduler. */
+    int nice;                      /* Niceness. */
+    fixed_t recent_cpu;            /* Recent CPU time received. */
+    bool charged;                  /* On our CPU's charged list? */
+    struct list_elem charged_elem; /* Element for the charged list. */
+    struct list_elem allelem;      /* Element for the all-threads list. */
 
     /* For priority donation. */
     struct lock* waiting_lock; /* Lock that this thread is waiting for. */
-    struct list donation_list; /* List of threads donating to this thread. */
-    struct semaphore*
-        waiting_sema; /* Semaphore that this thread is waiting for. */
+    struct lock* held_locks;   /* Heap of held locks, by waiters'
+                                  priority; see synch.c. */
 
     /* Shared between thread.c and synch.c. */
-    struct list_elem elem;          /* List element. */
-    struct list_elem donation_elem; /* Element for donation_list. */
+    struct list_elem elem; /* List element. */
+
+    /* Owned by threads/malloc.c. */
+    struct magazine magazine; /* Recently freed blocks. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
@@ -114,7 +129,8 @@ struct thread {
 #endif
 
     /* Owned by thread.c. */
-    struct intr_frame tf; /* Information for switching */
+    uint8_t* stack;       /* Saved stack pointer while switched out. */
+    struct intr_frame tf; /* Information for do_iret(). */
     unsigned magic;       /* Detects stack overflow. */
 };
 
@@ -123,16 +139,13 @@ struct thread {
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
-bool sooner_first(const struct list_elem* a,
-                  const struct list_elem* b,
-                  void* _);
 bool high_priority_first(const struct list_elem* a,
                          const struct list_elem* b,
                          void* _);
-void insert_sleep_list(void);
-void awake(int64_t);
 void thread_init(void);
 void thread_start(void);
+struct thread* thread_prepare_ap(struct cpu*);
+void thread_start_ap(void) NO_RETURN;
 
 void thread_tick(void);
 void thread_print_stats(void);
@@ -141,6 +154,7 @@ typedef void thread_func(void* aux);
 tid_t thread_create(const char* name, int priority, thread_func*, void*);
 
 void thread_block(void);
+void thread_block_locked(struct spinlock*);
 void thread_unblock(struct thread*);
 
 struct thread* thread_current(void);
@@ -152,6 +166,7 @@ void thread_yield(void);
 
 int thread_get_priority(void);
 void thread_set_priority(int);
+void thread_update_priority(struct thread*, int priority);
 
 int thread_get_nice(void);
 void thread_set_nice(int);
@@ -159,9 +174,5 @@ int thread_get_recent_cpu(void);
 int thread_get_load_avg(void);
 
 void do_iret(struct intr_frame* tf);
-bool high_priority_donation_elem(const struct list_elem* a,
-                                 const struct list_elem* b,
-                                 void* _);
-void update_donation_chain(struct thread* t);
 
 #endif /* threads/thread.h */
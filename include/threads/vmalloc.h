@@ -0,0 +1,25 @@
+#ifndef THREADS_VMALLOC_H
+#define THREADS_VMALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/vaddr.h"
+
+/* Kernel virtual address range for vmalloc(): 1 GB, well above
+   the direct map of physical memory at KERN_BASE but within the
+   same top-level page table entry, so that every page map level 4
+   shares it. */
+#define VMALLOC_BASE (KERN_BASE + 0x4000000000)
+#define VMALLOC_SIZE 0x40000000
+
+/* Returns true if VADDR lies in the vmalloc() range. */
+#define is_vmalloc_vaddr(vaddr)                   \
+    ((uint64_t)(vaddr) >= VMALLOC_BASE &&         \
+     (uint64_t)(vaddr) < VMALLOC_BASE + VMALLOC_SIZE)
+
+void vmalloc_init(void);
+void* vmalloc(size_t size);
+void vfree(void*);
+
+#endif /* threads/vmalloc.h */
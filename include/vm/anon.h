@@ -1,10 +1,16 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <stddef.h>
 #include "vm/vm.h"
 struct page;
 enum vm_type;
 
-struct anon_page {};
+struct anon_page {
+    size_t slot; /* Swap slot holding the page, or SWAP_SLOT_NONE. */
+};
+
+/* anon_page.slot of a page that is not in swap. */
+#define SWAP_SLOT_NONE ((size_t)-1)
 
 void vm_anon_init(void);
 bool anon_initializer(struct page* page, enum vm_type type, void* kva);
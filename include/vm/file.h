@@ -6,10 +6,15 @@
 struct page;
 enum vm_type;
 
-struct file_page {};
+struct file_page {
+    struct file* file; /* File the page is mapped from. */
+    off_t offset;      /* Offset of the page in FILE. */
+    size_t read_bytes; /* Bytes of the page that are in FILE. */
+};
 
 void vm_file_init(void);
 bool file_backed_initializer(struct page* page, enum vm_type type, void* kva);
+void file_backed_writeback(struct page* page);
 void* do_mmap(void* addr,
               size_t length,
               int writable,
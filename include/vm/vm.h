@@ -1,5 +1,6 @@
 #ifndef VM_VM_H
 #define VM_VM_H
+#include <list.h>
 #include <stdbool.h>
 #include "threads/palloc.h"
 
@@ -27,10 +28,12 @@ enum vm_type {
 #include "vm/anon.h"
 #include "vm/file.h"
 #include "vm/uninit.h"
+#include "vm/vma.h"
 #ifdef EFILESYS
 #include "filesys/page_cache.h"
 #endif
 
+struct mmu_gather;
 struct page_operations;
 struct thread;
 
@@ -46,6 +49,8 @@ struct page {
     struct frame* frame; /* Back reference for frame */
 
     /* Your implementation */
+    bool writable; /* May the user process write to the page? */
+    bool evicting; /* Being written out by vm_evict_frame()? */
 
     /* Per-type data are binded into the union.
      * Each function automatically detects the current union */
@@ -63,6 +68,13 @@ struct page {
 struct frame {
     void* kva;
     struct page* page;
+
+    /* Your implementation */
+    struct thread* owner;  /* Process whose pml4 maps PAGE. */
+    bool pinned;           /* Never evicted while true. */
+    struct list_elem elem; /* Element in the frame table. */
+    unsigned long gen;     /* Generation, for the MGLRU. */
+    bool promoted;         /* Does an access move it to the youngest? */
 };
 
 /* The function table for page operations.
@@ -81,10 +93,18 @@ struct page_operations {
 #define destroy(page) \
     if ((page)->operations->destroy) (page)->operations->destroy(page)
 
+/* Number of levels in a supplemental page table.  See vm.c. */
+#define SPT_LEVELS 4
+
 /* Representation of current process's memory space.
- * We don't want to force you to obey any specific design for this struct.
- * All designs up to you for this. */
-struct supplemental_page_table {};
+ * A radix tree over user virtual page numbers.  See vm.c. */
+struct supplemental_page_table {
+    void** root;          /* Top-level node. */
+    size_t page_cnt;      /* Number of pages in the table. */
+    struct vma_tree vmas; /* Regions the pages are created from. */
+};
+
+typedef bool spt_for_each_func(struct page* page, void* aux);
 
 #include "threads/thread.h"
 void supplemental_page_table_init(struct supplemental_page_table* spt);
@@ -94,6 +114,16 @@ void supplemental_page_table_kill(struct supplemental_page_table* spt);
 struct page* spt_find_page(struct supplemental_page_table* spt, void* va);
 bool spt_insert_page(struct supplemental_page_table* spt, struct page* page);
 void spt_remove_page(struct supplemental_page_table* spt, struct page* page);
+bool spt_for_each(struct supplemental_page_table* spt,
+                  spt_for_each_func* func,
+                  void* aux);
+bool spt_for_each_range(struct supplemental_page_table* spt,
+                        void* start,
+                        void* end,
+                        spt_for_each_func* func,
+                        void* aux);
+
+extern bool vm_mglru;
 
 void vm_init(void);
 bool vm_try_handle_fault(struct intr_frame* f,
@@ -110,6 +140,11 @@ bool vm_alloc_page_with_initializer(enum vm_type type,
                                     vm_initializer* init,
                                     void* aux);
 void vm_dealloc_page(struct page* page);
+void vm_free_frame(struct page* page, struct mmu_gather* tlb);
+void vm_unmap_page(struct page* page, struct mmu_gather* tlb);
+bool vm_pin_page(struct page* page);
+void vm_unpin_page(struct page* page);
+void vm_print_stats(void);
 bool vm_claim_page(void* va);
 enum vm_type page_get_type(struct page* page);
 
@@ -0,0 +1,54 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct supplemental_page_table;
+
+/* A virtual memory area: a run of pages of a process with the
+ * same backing and protection, such as an ELF segment, the
+ * stack, or an mmap region.  The pages' struct page objects are
+ * created only when they are first touched.  See vma.c. */
+struct vma {
+    void* start;          /* First page. */
+    void* end;            /* End of the last page, exclusive. */
+    bool writable;        /* May the process write to the pages? */
+    enum vm_type type;    /* Type of the pages: VM_ANON or VM_FILE. */
+    struct file* file;    /* Backing file, or a null pointer. */
+    off_t offset;         /* Offset in FILE of START. */
+    size_t read_bytes;    /* Bytes read from FILE; the rest are zeroed. */
+
+    /* Owned by vma.c. */
+    struct vma* left;     /* Left child in the interval tree. */
+    struct vma* right;    /* Right child in the interval tree. */
+    int height;           /* Height of the subtree. */
+    void* max_end;        /* Greatest END in the subtree. */
+};
+
+/* A process's VMAs, by address. */
+struct vma_tree {
+    struct vma* root;
+};
+
+void vma_init(void);
+void vma_tree_init(struct vma_tree*);
+struct vma* vma_map(struct supplemental_page_table*,
+                    void* start,
+                    size_t length,
+                    bool writable,
+                    enum vm_type type,
+                    struct file* file,
+                    off_t offset,
+                    size_t read_bytes);
+void vma_unmap(struct supplemental_page_table*, struct vma*);
+struct vma* vma_find(const struct vma_tree*, const void* va);
+struct vma* vma_overlap(const struct vma_tree*, const void* start,
+                        const void* end);
+bool vma_alloc_page(struct vma*, void* va, bool load);
+bool vma_copy_all(struct supplemental_page_table* dst,
+                  const struct supplemental_page_table* src);
+void vma_destroy_all(struct supplemental_page_table*);
+
+#endif /* VM_VMA_H */
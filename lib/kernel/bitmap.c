@@ -25,8 +25,9 @@ typedef unsigned long elem_type;
    inside, it's an array of elem_type (defined above) that
    simulates an array of bits. */
 struct bitmap {
-    size_t bit_cnt;  /* Number of bits. */
-    elem_type* bits; /* Elements that represent bits. */
+    size_t bit_cnt;     /* Number of bits. */
+    elem_type* bits;    /* Elements that represent bits. */
+    size_t first_false; /* Every bit below this index is true. */
 };
 
 /* Returns the index of the element that contains the bit
@@ -49,6 +50,76 @@ static inline size_t byte_cnt(size_t bit_cnt) {
     return sizeof(elem_type) * elem_cnt(bit_cnt);
 }
 
+/* Returns a bit mask of the bits in the element that contains
+   bit START that are at or after START and before END, which must
+   be greater than START.  Stores the index of the first bit after
+   the masked bits into *NEXT. */
+static inline elem_type range_mask(size_t start, size_t end, size_t* next) {
+    elem_type mask = (elem_type)-1 << (start % ELEM_BITS);
+
+    *next = (elem_idx(start) + 1) * ELEM_BITS;
+    if (*next > end)
+    {
+        mask &= ((elem_type)-1) >> (ELEM_BITS - (end - elem_idx(start) * ELEM_BITS));
+        *next = end;
+    }
+    return mask;
+}
+
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Skips whole elements whose bits all differ from VALUE. */
+static size_t find_next(const struct bitmap* b,
+                        size_t start,
+                        size_t end,
+                        bool value) {
+    size_t idx, last_idx;
+    elem_type bits;
+
+    if (start >= end) return end;
+
+    idx = elem_idx(start);
+    last_idx = elem_idx(end - 1);
+    bits = value ? b->bits[idx] : ~b->bits[idx];
+    bits &= (elem_type)-1 << (start % ELEM_BITS);
+    while (bits == 0)
+    {
+        if (++idx > last_idx) return end;
+        bits = value ? b->bits[idx] : ~b->bits[idx];
+    }
+
+    start = idx * ELEM_BITS + __builtin_ctzl(bits);
+    return start < end ? start : end;
+}
+
+/* Returns the number of 1-bits in BITS.  The kernel is built
+   without libgcc, and without -mpopcnt, so __builtin_popcountl()
+   would need a libgcc helper. */
+static inline int popcount(elem_type bits) {
+    bits -= (bits >> 1) & 0x5555555555555555UL;
+    bits = (bits & 0x3333333333333333UL) + ((bits >> 2) & 0x3333333333333333UL);
+    bits = (bits + (bits >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+    return (bits * 0x0101010101010101UL) >> 56;
+}
+
+/* Atomically sets the bits in MASK in element IDX of B to
+   true. */
+static inline void elem_mark(struct bitmap* b, size_t idx, elem_type mask) {
+    /* This is equivalent to `b->bits[idx] |= mask' except that it
+       is guaranteed to be atomic on a uniprocessor machine.  See
+       the description of the OR instruction in [IA32-v2b]. */
+    asm("lock orq %1, %0" : "=m"(b->bits[idx]) : "r"(mask) : "cc");
+}
+
+/* Atomically sets the bits in MASK in element IDX of B to
+   false. */
+static inline void elem_reset(struct bitmap* b, size_t idx, elem_type mask) {
+    /* This is equivalent to `b->bits[idx] &= ~mask' except that it
+       is guaranteed to be atomic on a uniprocessor machine.  See
+       the description of the AND instruction in [IA32-v2a]. */
+    asm("lock andq %1, %0" : "=m"(b->bits[idx]) : "r"(~mask) : "cc");
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type last_mask(const struct bitmap* b) {
@@ -68,6 +139,7 @@ struct bitmap* bitmap_create(size_t bit_cnt) {
     {
         b->bit_cnt = bit_cnt;
         b->bits = malloc(byte_cnt(bit_cnt));
+        b->first_false = 0;
         if (b->bits != NULL || bit_cnt == 0)
         {
             bitmap_set_all(b, false);
@@ -90,6 +162,7 @@ struct bitmap* bitmap_create_in_buf(size_t bit_cnt,
 
     b->bit_cnt = bit_cnt;
     b->bits = (elem_type*)(b + 1);
+    b->first_false = 0;
     bitmap_set_all(b, false);
     return b;
 }
@@ -130,24 +203,13 @@ void bitmap_set(struct bitmap* b, size_t idx, bool value) {
 
 /* Atomically sets the bit numbered BIT_IDX in B to true. */
 void bitmap_mark(struct bitmap* b, size_t bit_idx) {
-    size_t idx = elem_idx(bit_idx);
-    elem_type mask = bit_mask(bit_idx);
-
-    /* This is equivalent to `b->bits[idx] |= mask' except that it
-       is guaranteed to be atomic on a uniprocessor machine.  See
-       the description of the OR instruction in [IA32-v2b]. */
-    asm("lock orq %1, %0" : "=m"(b->bits[idx]) : "r"(mask) : "cc");
+    elem_mark(b, elem_idx(bit_idx), bit_mask(bit_idx));
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
 void bitmap_reset(struct bitmap* b, size_t bit_idx) {
-    size_t idx = elem_idx(bit_idx);
-    elem_type mask = bit_mask(bit_idx);
-
-    /* This is equivalent to `b->bits[idx] &= ~mask' except that it
-       is guaranteed to be atomic on a uniprocessor machine.  See
-       the description of the AND instruction in [IA32-v2a]. */
-    asm("lock andq %1, %0" : "=m"(b->bits[idx]) : "r"(~mask) : "cc");
+    elem_reset(b, elem_idx(bit_idx), bit_mask(bit_idx));
+    if (bit_idx < b->first_false) b->first_false = bit_idx;
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -161,6 +223,7 @@ void bitmap_flip(struct bitmap* b, size_t bit_idx) {
        is guaranteed to be atomic on a uniprocessor machine.  See
        the description of the XOR instruction in [IA32-v2b]. */
     asm("lock xorq %1, %0" : "=m"(b->bits[idx]) : "r"(mask) : "cc");
+    if (bit_idx < b->first_false) b->first_false = bit_idx;
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -184,13 +247,21 @@ void bitmap_set_multiple(struct bitmap* b,
                          size_t start,
                          size_t cnt,
                          bool value) {
-    size_t i;
+    size_t i, next, end = start + cnt;
 
     ASSERT(b != NULL);
     ASSERT(start <= b->bit_cnt);
     ASSERT(start + cnt <= b->bit_cnt);
 
-    for (i = 0; i < cnt; i++) bitmap_set(b, start + i, value);
+    for (i = start; i < end; i = next)
+    {
+        elem_type mask = range_mask(i, end, &next);
+        if (value)
+            elem_mark(b, elem_idx(i), mask);
+        else
+            elem_reset(b, elem_idx(i), mask);
+    }
+    if (!value && cnt > 0 && start < b->first_false) b->first_false = start;
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -199,16 +270,19 @@ size_t bitmap_count(const struct bitmap* b,
                     size_t start,
                     size_t cnt,
                     bool value) {
-    size_t i, value_cnt;
+    size_t i, next, end = start + cnt, true_cnt;
 
     ASSERT(b != NULL);
     ASSERT(start <= b->bit_cnt);
     ASSERT(start + cnt <= b->bit_cnt);
 
-    value_cnt = 0;
-    for (i = 0; i < cnt; i++)
-        if (bitmap_test(b, start + i) == value) value_cnt++;
-    return value_cnt;
+    true_cnt = 0;
+    for (i = start; i < end; i = next)
+    {
+        elem_type mask = range_mask(i, end, &next);
+        true_cnt += popcount(b->bits[elem_idx(i)] & mask);
+    }
+    return value ? true_cnt : cnt - true_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -217,15 +291,11 @@ bool bitmap_contains(const struct bitmap* b,
                      size_t start,
                      size_t cnt,
                      bool value) {
-    size_t i;
-
     ASSERT(b != NULL);
     ASSERT(start <= b->bit_cnt);
     ASSERT(start + cnt <= b->bit_cnt);
 
-    for (i = 0; i < cnt; i++)
-        if (bitmap_test(b, start + i) == value) return true;
-    return false;
+    return find_next(b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -248,6 +318,40 @@ bool bitmap_all(const struct bitmap* b, size_t start, size_t cnt) {
 
 /* Finding set or unset bits. */
 
+/* Does the work of bitmap_scan().  If CNT is nonzero, also stores
+   the index of the first bit at or after START that is set to
+   VALUE, or B's size if there is none, into *FIRST.
+
+   A scan for false bits starts at B's first_false hint instead
+   of START when that is further along, so that repeated
+   allocations do not rescan the allocated bits at the front of
+   B.  Either way, it jumps from each run of VALUE bits that is too
+   short to the next, skipping whole elements at a time. */
+static size_t scan(const struct bitmap* b,
+                   size_t start,
+                   size_t cnt,
+                   bool value,
+                   size_t* first) {
+    size_t i, run_end;
+
+    ASSERT(b != NULL);
+    ASSERT(start <= b->bit_cnt);
+
+    if (cnt == 0) return start;
+    if (!value && start < b->first_false) start = b->first_false;
+    *first = start;
+    if (cnt > b->bit_cnt) return BITMAP_ERROR;
+
+    *first = i = find_next(b, start, b->bit_cnt, value);
+    while (i + cnt <= b->bit_cnt)
+    {
+        run_end = find_next(b, i, i + cnt, !value);
+        if (run_end == i + cnt) return i;
+        i = find_next(b, run_end + 1, b->bit_cnt, value);
+    }
+    return BITMAP_ERROR;
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
@@ -256,17 +360,9 @@ size_t bitmap_scan(const struct bitmap* b,
                    size_t start,
                    size_t cnt,
                    bool value) {
-    ASSERT(b != NULL);
-    ASSERT(start <= b->bit_cnt);
+    size_t first;
 
-    if (cnt <= b->bit_cnt)
-    {
-        size_t last = b->bit_cnt - cnt;
-        size_t i;
-        for (i = start; i <= last; i++)
-            if (!bitmap_contains(b, i, cnt, !value)) return i;
-    }
-    return BITMAP_ERROR;
+    return scan(b, start, cnt, value, &first);
 }
 
 /* Finds the first group of CNT consecutive bits in B at or after
@@ -280,8 +376,14 @@ size_t bitmap_scan_and_flip(struct bitmap* b,
                             size_t start,
                             size_t cnt,
                             bool value) {
-    size_t idx = bitmap_scan(b, start, cnt, value);
+    size_t first;
+    size_t idx = scan(b, start, cnt, value, &first);
     if (idx != BITMAP_ERROR) bitmap_set_multiple(b, idx, cnt, !value);
+
+    /* If the scan started at or before the hint, every bit before
+       FIRST is now known to be true. */
+    if (!value && cnt > 0 && start <= b->first_false)
+        b->first_false = idx == first ? idx + cnt : first;
     return idx;
 }
 
@@ -300,6 +402,7 @@ bool bitmap_read(struct bitmap* b, struct file* file) {
         off_t size = byte_cnt(b->bit_cnt);
         success = file_read_at(file, b->bits, size, 0) == size;
         b->bits[elem_cnt(b->bit_cnt) - 1] &= last_mask(b);
+        b->first_false = 0;
     }
     return success;
 }
@@ -62,6 +62,7 @@ static int64_t write_cnt;
 /* Enable console locking. */
 void console_init(void) {
     lock_init(&console_lock);
+    lock_set_name(&console_lock, "console");
     use_console_lock = true;
 }
 
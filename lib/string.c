@@ -1,6 +1,73 @@
 #include <debug.h>
+#include <stdint.h>
 #include <string.h>
 
+/* The block and string functions below work on 8-byte words
+   where they can, instead of a byte at a time.  Copies and fills
+   of more than a few bytes go a byte at a time up to a word
+   boundary in the destination, then a word at a time with the
+   REP MOVSQ and REP STOSQ instructions, then finish the last few
+   bytes.  Searches load a word at a time and test all of its
+   bytes at once with HAS_ZERO.  Aligned loads never cross a page
+   boundary, so reading past the end of a string within its last
+   word cannot fault. */
+
+/* A word that may be unaligned and may alias any other type. */
+typedef uint64_t word_t __attribute__((may_alias, aligned(1)));
+
+#define WORD_SIZE sizeof(uint64_t)
+#define ONES 0x0101010101010101ULL  /* 0x01 in every byte. */
+#define HIGHS 0x8080808080808080ULL /* 0x80 in every byte. */
+
+/* Nonzero if some byte in W is zero.  The lowest set bit is in
+   the first (lowest-addressed) zero byte; higher bits may be set
+   spuriously. */
+#define HAS_ZERO(W) (((W)-ONES) & ~(W) & HIGHS)
+
+/* Index of the first byte flagged in MASK, as made by
+   HAS_ZERO. */
+#define FIRST_BYTE(MASK) (__builtin_ctzll(MASK) / 8)
+
+/* Blocks shorter than this are handled a byte at a time. */
+#define SMALL_SIZE 16
+
+/* Copies CNT bytes from *SRC to *DST, advancing both. */
+static inline __attribute__((always_inline)) void rep_movsb(
+    unsigned char** dst, const unsigned char** src, size_t cnt) {
+    __asm__ volatile("rep movsb"
+                     : "+D"(*dst), "+S"(*src), "+c"(cnt)
+                     :
+                     : "memory");
+}
+
+/* Copies CNT words from *SRC to *DST, advancing both. */
+static inline __attribute__((always_inline)) void rep_movsq(
+    unsigned char** dst, const unsigned char** src, size_t cnt) {
+    __asm__ volatile("rep movsq"
+                     : "+D"(*dst), "+S"(*src), "+c"(cnt)
+                     :
+                     : "memory");
+}
+
+/* Stores the low byte of VALUE into CNT bytes at *DST, advancing
+   it. */
+static inline __attribute__((always_inline)) void rep_stosb(
+    unsigned char** dst, uint64_t value, size_t cnt) {
+    __asm__ volatile("rep stosb"
+                     : "+D"(*dst), "+c"(cnt)
+                     : "a"(value)
+                     : "memory");
+}
+
+/* Stores VALUE into CNT words at *DST, advancing it. */
+static inline __attribute__((always_inline)) void rep_stosq(
+    unsigned char** dst, uint64_t value, size_t cnt) {
+    __asm__ volatile("rep stosq"
+                     : "+D"(*dst), "+c"(cnt)
+                     : "a"(value)
+                     : "memory");
+}
+
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
 void* memcpy(void* dst_, const void* src_, size_t size) {
@@ -10,6 +77,15 @@ void* memcpy(void* dst_, const void* src_, size_t size) {
     ASSERT(dst != NULL || size == 0);
     ASSERT(src != NULL || size == 0);
 
+    if (size >= SMALL_SIZE)
+    {
+        size_t head = -(uintptr_t)dst % WORD_SIZE;
+
+        rep_movsb(&dst, &src, head);
+        size -= head;
+        rep_movsq(&dst, &src, size / WORD_SIZE);
+        size %= WORD_SIZE;
+    }
     while (size-- > 0) *dst++ = *src++;
 
     return dst_;
@@ -24,18 +100,23 @@ void* memmove(void* dst_, const void* src_, size_t size) {
     ASSERT(dst != NULL || size == 0);
     ASSERT(src != NULL || size == 0);
 
-    if (dst < src)
-    {
-        while (size-- > 0) *dst++ = *src++;
-    }
-    else
+    /* Copying forward is safe unless DST starts inside SRC: each
+       word is read before any later word is written. */
+    if (dst <= src || dst >= src + size) return memcpy(dst_, src_, size);
+
+    dst += size;
+    src += size;
+    for (; size > 0 && (uintptr_t)dst % WORD_SIZE != 0; size--)
+        *--dst = *--src;
+    for (; size >= WORD_SIZE; size -= WORD_SIZE)
     {
-        dst += size;
-        src += size;
-        while (size-- > 0) *--dst = *--src;
+        dst -= WORD_SIZE;
+        src -= WORD_SIZE;
+        *(word_t*)dst = *(const word_t*)src;
     }
+    while (size-- > 0) *--dst = *--src;
 
-    return dst;
+    return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -49,6 +130,17 @@ int memcmp(const void* a_, const void* b_, size_t size) {
     ASSERT(a != NULL || size == 0);
     ASSERT(b != NULL || size == 0);
 
+    for (; size > 0 && (uintptr_t)a % WORD_SIZE != 0; size--, a++, b++)
+        if (*a != *b) return *a > *b ? +1 : -1;
+    for (; size >= WORD_SIZE; size -= WORD_SIZE, a += WORD_SIZE, b += WORD_SIZE)
+    {
+        uint64_t x = *(const word_t*)a;
+        uint64_t y = *(const word_t*)b;
+
+        /* Byte-swapped, the first byte is the most significant. */
+        if (x != y)
+            return __builtin_bswap64(x) > __builtin_bswap64(y) ? +1 : -1;
+    }
     for (; size-- > 0; a++, b++)
         if (*a != *b) return *a > *b ? +1 : -1;
     return 0;
@@ -81,9 +173,19 @@ int strcmp(const char* a_, const char* b_) {
 void* memchr(const void* block_, int ch_, size_t size) {
     const unsigned char* block = block_;
     unsigned char ch = ch_;
+    uint64_t pattern = ch * ONES;
 
     ASSERT(block != NULL || size == 0);
 
+    for (; size > 0 && (uintptr_t)block % WORD_SIZE != 0; size--, block++)
+        if (*block == ch) return (void*)block;
+    for (; size >= WORD_SIZE; size -= WORD_SIZE, block += WORD_SIZE)
+    {
+        uint64_t w = *(const word_t*)block ^ pattern;
+        uint64_t match = HAS_ZERO(w);
+
+        if (match != 0) return (void*)(block + FIRST_BYTE(match));
+    }
     for (; size-- > 0; block++)
         if (*block == ch) return (void*)block;
 
@@ -96,16 +198,27 @@ void* memchr(const void* block_, int ch_, size_t size) {
    STRING. */
 char* strchr(const char* string, int c_) {
     char c = c_;
+    uint64_t pattern = (unsigned char)c * ONES;
 
     ASSERT(string);
 
-    for (;;)
+    for (; (uintptr_t)string % WORD_SIZE != 0; string++)
         if (*string == c)
             return (char*)string;
         else if (*string == '\0')
             return NULL;
-        else
-            string++;
+    for (;; string += WORD_SIZE)
+    {
+        uint64_t w = *(const word_t*)string;
+        uint64_t x = w ^ pattern;
+        uint64_t match = HAS_ZERO(w) | HAS_ZERO(x);
+
+        if (match != 0)
+        {
+            string += FIRST_BYTE(match);
+            return *string == c ? (char*)string : NULL;
+        }
+    }
 }
 
 /* Returns the length of the initial substring of STRING that
@@ -245,6 +358,15 @@ void* memset(void* dst_, int value, size_t size) {
 
     ASSERT(dst != NULL || size == 0);
 
+    if (size >= SMALL_SIZE)
+    {
+        size_t head = -(uintptr_t)dst % WORD_SIZE;
+
+        rep_stosb(&dst, value, head);
+        size -= head;
+        rep_stosq(&dst, (unsigned char)value * ONES, size / WORD_SIZE);
+        size %= WORD_SIZE;
+    }
     while (size-- > 0) *dst++ = value;
 
     return dst_;
@@ -256,8 +378,15 @@ size_t strlen(const char* string) {
 
     ASSERT(string);
 
-    for (p = string; *p != '\0'; p++) continue;
-    return p - string;
+    for (p = string; (uintptr_t)p % WORD_SIZE != 0; p++)
+        if (*p == '\0') return p - string;
+    for (;; p += WORD_SIZE)
+    {
+        uint64_t w = *(const word_t*)p;
+        uint64_t zero = HAS_ZERO(w);
+
+        if (zero != 0) return p - string + FIRST_BYTE(zero);
+    }
 }
 
 /* If STRING is less than MAXLEN characters in length, returns
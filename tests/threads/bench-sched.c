@@ -0,0 +1,168 @@
+/* Scheduler throughput benchmark.
+
+   Runs kernel threads for BENCH_TICKS timer ticks in each of
+   three workloads and prints how much work they got done per
+   tick:
+
+   - spin: each thread counts in a loop, sharing nothing.
+   - yield: each thread calls thread_yield() in a loop.
+   - ping-pong: pairs of threads hand a pair of semaphores back
+     and forth.
+
+   Each workload runs with 1, 2, 4, ... threads or pairs, up to
+   twice the number of CPUs.  With enough threads, the total
+   should grow with the number of CPUs, so run this with
+   "pintos --smp N" for a few N (see BENCH_SMP in Make.tests) and
+   compare.  The numbers vary from run to run and machine to
+   machine, so bench-sched.ck ignores them. */
+
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "tests/threads/tests.h"
+#include "threads/smp.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Length of each run. */
+#define BENCH_TICKS (TIMER_FREQ / 2)
+
+/* Most threads or pairs in one run. */
+#define WORKER_MAX (2 * CPU_MAX)
+
+/* One worker thread, or one pair of them.  Each has a cache line
+   to itself, so that the workers do not slow each other down by
+   sharing one. */
+struct worker {
+    int64_t count;         /* Work done. */
+    struct semaphore ping; /* Ping-pong: upped by the first thread. */
+    struct semaphore pong; /* Ping-pong: upped by the second one. */
+} __attribute__((aligned(64)));
+
+static struct worker workers[WORKER_MAX];
+
+static struct semaphore go;   /* Upped once per thread to start it. */
+static struct semaphore done; /* Upped by each thread as it ends. */
+static volatile bool stop;    /* Set when the run is over. */
+
+static thread_func spin_thread;
+static thread_func yield_thread;
+static thread_func ping_thread;
+static thread_func pong_thread;
+
+static void run(const char*, int, bool, thread_func*, thread_func*);
+
+void test_bench_sched(void) {
+    int cnt;
+
+    printf("running on %d CPU(s), %d ticks per run\n", cpu_cnt, BENCH_TICKS);
+    for (cnt = 1; cnt <= 2 * cpu_cnt && cnt <= WORKER_MAX; cnt *= 2)
+    {
+        run("spin", cnt, false, spin_thread, NULL);
+        run("yield", cnt, false, yield_thread, NULL);
+        run("ping-pong", cnt, true, ping_thread, pong_thread);
+    }
+}
+
+/* Runs CNT threads of FIRST, or, if PAIRS is true, CNT pairs of
+   FIRST and SECOND threads, for BENCH_TICKS ticks and prints the
+   work they did per tick. */
+static void run(const char* name,
+                int cnt,
+                bool pairs,
+                thread_func* first,
+                thread_func* second) {
+    int thread_cnt = pairs ? 2 * cnt : cnt;
+    int64_t start, elapsed, total;
+    int i;
+
+    /* The workers run below our priority, so that we get the CPU
+       back as soon as the run is over. */
+    sema_init(&go, 0);
+    sema_init(&done, 0);
+    stop = false;
+    for (i = 0; i < cnt; i++)
+    {
+        char label[16];
+
+        workers[i].count = 0;
+        sema_init(&workers[i].ping, 0);
+        sema_init(&workers[i].pong, 0);
+        snprintf(label, sizeof label, "worker %d", i);
+        thread_create(label, PRI_DEFAULT - 1, first, &workers[i]);
+        if (pairs)
+            thread_create(label, PRI_DEFAULT - 1, second, &workers[i]);
+    }
+
+    start = timer_ticks();
+    for (i = 0; i < thread_cnt; i++) sema_up(&go);
+    timer_sleep(BENCH_TICKS);
+    stop = true;
+    elapsed = timer_elapsed(start);
+    for (i = 0; i < thread_cnt; i++) sema_down(&done);
+
+    total = 0;
+    for (i = 0; i < cnt; i++) total += workers[i].count;
+    printf("%-9s %2d %s: %8lld per tick\n", name, cnt,
+           pairs ? "pairs  " : "threads", (long long)(total / elapsed));
+}
+
+/* Counts as fast as it can. */
+static void spin_thread(void* w_) {
+    struct worker* w = w_;
+    int64_t count = 0;
+
+    sema_down(&go);
+    while (!stop) count++;
+    w->count = count;
+    sema_up(&done);
+}
+
+/* Yields as often as it can. */
+static void yield_thread(void* w_) {
+    struct worker* w = w_;
+    int64_t count = 0;
+
+    sema_down(&go);
+    while (!stop)
+    {
+        thread_yield();
+        count++;
+    }
+    w->count = count;
+    sema_up(&done);
+}
+
+/* Starts each round trip of a ping-pong pair, and counts them.
+   On the way out, wakes up its partner once more, in case it
+   went back to sleep before it saw STOP. */
+static void ping_thread(void* w_) {
+    struct worker* w = w_;
+    int64_t count = 0;
+
+    sema_down(&go);
+    while (!stop)
+    {
+        sema_up(&w->ping);
+        sema_down(&w->pong);
+        count++;
+    }
+    sema_up(&w->ping);
+    w->count = count;
+    sema_up(&done);
+}
+
+/* Answers each ping with a pong. */
+static void pong_thread(void* w_) {
+    struct worker* w = w_;
+
+    sema_down(&go);
+    for (;;)
+    {
+        sema_down(&w->ping);
+        sema_up(&w->pong);
+        if (stop) break;
+    }
+    sema_up(&done);
+}
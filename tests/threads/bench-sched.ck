@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+# Throughput differs from run to run, so only compare the rest.
+@output = grep (!/ per tick$|^running on /, @output);
+compare_output ("run", \@output, [<<'EOF']);
+(bench-sched) begin
+(bench-sched) end
+EOF
+pass;
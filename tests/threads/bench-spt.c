@@ -0,0 +1,199 @@
+/* Benchmark for the supplemental page table in vm/vm.c.
+
+   Puts the same PAGE_CNT pages, one every page from USER_BASE,
+   into a supplemental page table and into a lib/kernel/hash.c
+   table keyed by virtual address.  Then times, for each one,
+   insertion, lookups in address order and in random order,
+   lookups that miss, iteration, and destruction.  Both tables
+   are checked against each other along the way.
+
+   Only built into kernels with VM, and needs more memory than
+   the default; see Make.tests.  The timings vary from run to run
+   and machine to machine, so bench-spt.ck ignores them. */
+
+#ifdef VM
+#include <debug.h>
+#include <hash.h>
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "intrinsic.h"
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* Number of pages in each table. */
+#define PAGE_CNT (1024 * 1024)
+
+/* Lowest page in the tables. */
+#define USER_BASE ((uint8_t*)0x10000000)
+
+/* Pages for the benchmark: never loaded, nothing to destroy. */
+static const struct page_operations bench_ops = {.type = VM_ANON};
+
+/* An entry in the hash table. */
+struct hash_page {
+    struct hash_elem elem; /* Hash table element. */
+    void* va;              /* Virtual address, the key. */
+    struct page* page;     /* The page. */
+};
+
+/* Returns a hash of the virtual address of hash_page E. */
+static uint64_t hash_page_hash(const struct hash_elem* e, void* aux UNUSED) {
+    const struct hash_page* p = hash_entry(e, struct hash_page, elem);
+    return hash_bytes(&p->va, sizeof p->va);
+}
+
+/* Returns true if hash_page A precedes B. */
+static bool hash_page_less(const struct hash_elem* a,
+                           const struct hash_elem* b,
+                           void* aux UNUSED) {
+    return hash_entry(a, struct hash_page, elem)->va <
+           hash_entry(b, struct hash_page, elem)->va;
+}
+
+/* Frees hash_page E. */
+static void hash_page_free(struct hash_elem* e, void* aux UNUSED) {
+    free(hash_entry(e, struct hash_page, elem));
+}
+
+/* Returns the page at VA in H, or a null pointer. */
+static struct page* hash_find_page(struct hash* h, void* va) {
+    struct hash_page key;
+    struct hash_elem* e;
+
+    key.va = va;
+    e = hash_find(h, &key.elem);
+    return e != NULL ? hash_entry(e, struct hash_page, elem)->page : NULL;
+}
+
+/* Counts the pages passed to it in *AUX. */
+static bool count_page(struct page* page UNUSED, void* aux) {
+    (*(size_t*)aux)++;
+    return true;
+}
+
+/* Number of hash_pages passed to count_hash_page(). */
+static size_t hash_cnt;
+
+/* Counts the hash_pages passed to it in hash_cnt. */
+static void count_hash_page(struct hash_elem* e UNUSED, void* aux UNUSED) {
+    hash_cnt++;
+}
+
+/* Returns the address of page number I. */
+static void* page_va(size_t i) { return USER_BASE + i * PGSIZE; }
+
+/* Prints the average cycles per page taken by each table. */
+static void report(const char* what, uint64_t spt_cycles, uint64_t hash_cycles) {
+    printf("%-16s spt %6llu  hash %6llu cycles/page\n", what,
+           (unsigned long long)(spt_cycles / PAGE_CNT),
+           (unsigned long long)(hash_cycles / PAGE_CNT));
+}
+
+/* Compares the two tables. */
+void test_bench_spt(void) {
+    struct supplemental_page_table spt;
+    struct hash hash;
+    size_t* order;
+    uint64_t start, spt_cycles, hash_cycles;
+    size_t i, cnt;
+
+    /* Random order for lookups. */
+    order = malloc(PAGE_CNT * sizeof *order);
+    ASSERT(order != NULL);
+    for (i = 0; i < PAGE_CNT; i++) order[i] = i;
+    for (i = 0; i < PAGE_CNT; i++)
+    {
+        size_t j = i + random_ulong() % (PAGE_CNT - i);
+        size_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    /* Insertion. */
+    supplemental_page_table_init(&spt);
+    ASSERT(hash_init(&hash, hash_page_hash, hash_page_less, NULL));
+    spt_cycles = hash_cycles = 0;
+    for (i = 0; i < PAGE_CNT; i++)
+    {
+        struct page* page = malloc(sizeof *page);
+        uint64_t t;
+
+        ASSERT(page != NULL);
+        page->operations = &bench_ops;
+        page->va = page_va(i);
+        page->frame = NULL;
+        t = rdtsc();
+        ASSERT(spt_insert_page(&spt, page));
+        spt_cycles += rdtsc() - t;
+    }
+    for (i = 0; i < PAGE_CNT; i++)
+    {
+        struct hash_page* p = malloc(sizeof *p);
+        uint64_t t;
+
+        ASSERT(p != NULL);
+        p->va = page_va(i);
+        p->page = spt_find_page(&spt, p->va);
+        t = rdtsc();
+        ASSERT(hash_insert(&hash, &p->elem) == NULL);
+        hash_cycles += rdtsc() - t;
+    }
+    report("insert", spt_cycles, hash_cycles);
+
+    /* Lookups in address order. */
+    start = rdtsc();
+    for (i = 0; i < PAGE_CNT; i++) ASSERT(spt_find_page(&spt, page_va(i)));
+    spt_cycles = rdtsc() - start;
+    start = rdtsc();
+    for (i = 0; i < PAGE_CNT; i++) ASSERT(hash_find_page(&hash, page_va(i)));
+    report("find, in order", spt_cycles, rdtsc() - start);
+
+    /* Lookups in random order. */
+    start = rdtsc();
+    for (i = 0; i < PAGE_CNT; i++)
+        ASSERT(spt_find_page(&spt, page_va(order[i]))->va == page_va(order[i]));
+    spt_cycles = rdtsc() - start;
+    start = rdtsc();
+    for (i = 0; i < PAGE_CNT; i++)
+        ASSERT(hash_find_page(&hash, page_va(order[i]))->va ==
+               page_va(order[i]));
+    report("find, random", spt_cycles, rdtsc() - start);
+
+    /* Lookups that miss, above the last page. */
+    start = rdtsc();
+    for (i = 0; i < PAGE_CNT; i++)
+        ASSERT(spt_find_page(&spt, page_va(PAGE_CNT + order[i])) == NULL);
+    spt_cycles = rdtsc() - start;
+    start = rdtsc();
+    for (i = 0; i < PAGE_CNT; i++)
+        ASSERT(hash_find_page(&hash, page_va(PAGE_CNT + order[i])) == NULL);
+    report("find, missing", spt_cycles, rdtsc() - start);
+
+    /* Iteration. */
+    cnt = 0;
+    start = rdtsc();
+    spt_for_each(&spt, count_page, &cnt);
+    spt_cycles = rdtsc() - start;
+    ASSERT(cnt == PAGE_CNT);
+    hash_cnt = 0;
+    start = rdtsc();
+    hash_apply(&hash, count_hash_page);
+    report("iterate", spt_cycles, rdtsc() - start);
+    ASSERT(hash_cnt == PAGE_CNT);
+
+    /* Destruction.  The hash table only frees its own entries;
+       killing the supplemental page table frees the pages. */
+    start = rdtsc();
+    hash_destroy(&hash, hash_page_free);
+    hash_cycles = rdtsc() - start;
+    start = rdtsc();
+    supplemental_page_table_kill(&spt);
+    report("destroy", rdtsc() - start, hash_cycles);
+    msg("tables agree on %d pages", PAGE_CNT);
+
+    free(order);
+}
+#endif /* VM */
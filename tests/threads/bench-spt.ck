@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+# Timings differ from run to run, so only compare the rest.
+@output = grep (!/ cycles/, @output);
+compare_output ("run", \@output, [<<'EOF']);
+(bench-spt) begin
+(bench-spt) tables agree on 1048576 pages
+(bench-spt) end
+EOF
+pass;
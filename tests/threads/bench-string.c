@@ -0,0 +1,236 @@
+/* Test program and microbenchmark for the block and string
+   functions in lib/string.c.
+
+   Checks memcpy(), memmove(), memset(), memcmp(), memchr(),
+   strchr() and strlen() against simple byte-at-a-time versions,
+   like the ones lib/string.c used to have, at every alignment,
+   then times both versions on blocks of 16 B, 512 B, 4 kB and
+   64 kB.  The timings vary from run to run and machine to
+   machine, so bench-string.ck ignores them. */
+
+#include <debug.h>
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "intrinsic.h"
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Size of each buffer, the largest size we time. */
+#define BUF_SIZE (64 * 1024)
+
+/* Largest size we check for correctness. */
+#define CHECK_SIZE 300
+
+/* Number of times each timed call is repeated. */
+#define REPEAT_CNT 64
+
+static void* byte_memcpy(void*, const void*, size_t);
+static void* byte_memmove(void*, const void*, size_t);
+static void* byte_memset(void*, int, size_t);
+static int byte_memcmp(const void*, const void*, size_t);
+static void* byte_memchr(const void*, int, size_t);
+static char* byte_strchr(const char*, int);
+static size_t byte_strlen(const char*);
+
+static void check(unsigned char* a, unsigned char* b, unsigned char* c);
+static void bench(unsigned char* a, unsigned char* b);
+
+/* Test and time the string functions. */
+void test_bench_string(void) {
+    unsigned char* a = palloc_get_multiple(PAL_ASSERT, BUF_SIZE / PGSIZE);
+    unsigned char* b = palloc_get_multiple(PAL_ASSERT, BUF_SIZE / PGSIZE);
+    unsigned char* c = palloc_get_multiple(PAL_ASSERT, BUF_SIZE / PGSIZE);
+
+    check(a, b, c);
+    bench(a, b);
+
+    palloc_free_multiple(a, BUF_SIZE / PGSIZE);
+    palloc_free_multiple(b, BUF_SIZE / PGSIZE);
+    palloc_free_multiple(c, BUF_SIZE / PGSIZE);
+}
+
+/* Fills the first SIZE bytes of BUF with random bytes no greater
+   than MAX. */
+static void fill_random(unsigned char* buf, size_t size, int max) {
+    size_t i;
+
+    for (i = 0; i < size; i++) buf[i] = random_ulong() % (max + 1);
+}
+
+/* Returns -1, 0 or +1 as X is negative, zero or positive. */
+static int sign(int x) { return (x > 0) - (x < 0); }
+
+/* Checks each function against its byte-at-a-time version at
+   every pair of alignments and many sizes, using buffers A, B
+   and C. */
+static void check(unsigned char* a, unsigned char* b, unsigned char* c) {
+    size_t size, ofs1, ofs2;
+
+    for (size = 0; size < CHECK_SIZE; size = size * 5 / 4 + 1)
+    {
+        for (ofs1 = 0; ofs1 < 16; ofs1++)
+            for (ofs2 = 0; ofs2 < 16; ofs2++)
+            {
+                int ch = random_ulong() % 4;
+
+                /* memcpy(), memmove() and memset(). */
+                fill_random(a, CHECK_SIZE * 2, 255);
+                memcpy(b, a, CHECK_SIZE * 2);
+                memcpy(c, a, CHECK_SIZE * 2);
+                ASSERT(memcpy(b + ofs1, a + ofs2, size) == b + ofs1);
+                byte_memcpy(c + ofs1, a + ofs2, size);
+                ASSERT(!byte_memcmp(b, c, CHECK_SIZE * 2));
+                ASSERT(memmove(b + ofs1, b + ofs2, size) == b + ofs1);
+                byte_memmove(c + ofs1, c + ofs2, size);
+                ASSERT(!byte_memcmp(b, c, CHECK_SIZE * 2));
+                ASSERT(memset(b + ofs1, ch, size) == b + ofs1);
+                byte_memset(c + ofs1, ch, size);
+                ASSERT(!byte_memcmp(b, c, CHECK_SIZE * 2));
+
+                /* memcmp() and memchr(), on bytes that often
+                   match. */
+                fill_random(a, CHECK_SIZE * 2, 3);
+                memcpy(b, a, CHECK_SIZE * 2);
+                b[ofs2 + random_ulong() % (size + 1)] ^= random_ulong() % 2;
+                ASSERT(sign(memcmp(a + ofs2, b + ofs2, size)) ==
+                       byte_memcmp(a + ofs2, b + ofs2, size));
+                ASSERT(memchr(a + ofs1, ch, size) ==
+                       byte_memchr(a + ofs1, ch, size));
+
+                /* strlen() and strchr(). */
+                fill_random(a, CHECK_SIZE * 2, 3);
+                for (size_t i = 0; i < CHECK_SIZE * 2; i++) a[i]++;
+                a[ofs1 + size] = '\0';
+                ASSERT(strlen((char*)a + ofs1) == size);
+                ASSERT(strchr((char*)a + ofs1, ch) ==
+                       byte_strchr((char*)a + ofs1, ch));
+            }
+    }
+    msg("checked sizes below %d at every alignment", CHECK_SIZE);
+}
+
+/* Keeps the compiler from dropping timed calls whose results
+   are unused. */
+static volatile uintptr_t sink;
+
+/* Returns the average number of cycles taken by CALL. */
+#define TIME(CALL)                                                        \
+    ({                                                                    \
+        uint64_t start_ = rdtsc();                                        \
+        for (int i_ = 0; i_ < REPEAT_CNT; i_++) sink = (uintptr_t)(CALL); \
+        (rdtsc() - start_) / REPEAT_CNT;                                  \
+    })
+
+/* Prints the average cycles per call for the byte-at-a-time and
+   the current version of a function on SIZE bytes. */
+static void report(const char* name, size_t size, uint64_t old,
+                   uint64_t new) {
+    printf("%-8s %6zu B: %8llu -> %7llu cycles (%llu.%01llux)\n", name, size,
+           old, new, old / (new ? new : 1),
+           old * 10 / (new ? new : 1) % 10);
+}
+
+/* Times each function, old and new, on buffers A and B. */
+static void bench(unsigned char* a, unsigned char* b) {
+    static const size_t sizes[] = {16, 512, 4096, BUF_SIZE};
+    size_t i;
+
+    memset(a, 'x', BUF_SIZE);
+    memset(b, 'x', BUF_SIZE);
+    for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+        size_t size = sizes[i];
+
+        report("memcpy", size, TIME(byte_memcpy(b, a, size)),
+               TIME(memcpy(b, a, size)));
+        report("memmove", size, TIME(byte_memmove(b + 1, b, size - 1)),
+               TIME(memmove(b + 1, b, size - 1)));
+        report("memset", size, TIME(byte_memset(b, 'x', size)),
+               TIME(memset(b, 'x', size)));
+        report("memcmp", size, TIME(byte_memcmp(a, b, size)),
+               TIME(memcmp(a, b, size)));
+        report("memchr", size, TIME(byte_memchr(a, 0, size)),
+               TIME(memchr(a, 0, size)));
+
+        a[size - 1] = '\0';
+        report("strlen", size, TIME(byte_strlen((char*)a)),
+               TIME(strlen((char*)a)));
+        report("strchr", size, TIME(byte_strchr((char*)a, 'y')),
+               TIME(strchr((char*)a, 'y')));
+        a[size - 1] = 'x';
+    }
+}
+
+/* The byte-at-a-time versions. */
+
+static void* byte_memcpy(void* dst_, const void* src_, size_t size) {
+    unsigned char* dst = dst_;
+    const unsigned char* src = src_;
+
+    while (size-- > 0) *dst++ = *src++;
+    return dst_;
+}
+
+static void* byte_memmove(void* dst_, const void* src_, size_t size) {
+    unsigned char* dst = dst_;
+    const unsigned char* src = src_;
+
+    if (dst < src)
+    {
+        while (size-- > 0) *dst++ = *src++;
+    }
+    else
+    {
+        dst += size;
+        src += size;
+        while (size-- > 0) *--dst = *--src;
+    }
+    return dst_;
+}
+
+static void* byte_memset(void* dst_, int value, size_t size) {
+    unsigned char* dst = dst_;
+
+    while (size-- > 0) *dst++ = value;
+    return dst_;
+}
+
+static int byte_memcmp(const void* a_, const void* b_, size_t size) {
+    const unsigned char* a = a_;
+    const unsigned char* b = b_;
+
+    for (; size-- > 0; a++, b++)
+        if (*a != *b) return *a > *b ? +1 : -1;
+    return 0;
+}
+
+static void* byte_memchr(const void* block_, int ch_, size_t size) {
+    const unsigned char* block = block_;
+    unsigned char ch = ch_;
+
+    for (; size-- > 0; block++)
+        if (*block == ch) return (void*)block;
+    return NULL;
+}
+
+static char* byte_strchr(const char* string, int c_) {
+    char c = c_;
+
+    for (;;)
+        if (*string == c)
+            return (char*)string;
+        else if (*string == '\0')
+            return NULL;
+        else
+            string++;
+}
+
+static size_t byte_strlen(const char* string) {
+    const char* p;
+
+    for (p = string; *p != '\0'; p++) continue;
+    return p - string;
+}
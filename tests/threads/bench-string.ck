@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+# Timings differ from run to run, so only compare the rest.
+@output = grep (!/ cycles/, @output);
+compare_output ("run", \@output, [<<'EOF']);
+(bench-string) begin
+(bench-string) checked sizes below 300 at every alignment
+(bench-string) end
+EOF
+pass;
@@ -36,6 +36,11 @@ static const struct test tests[] = {
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"bench-string", test_bench_string},
+    {"bench-sched", test_bench_sched},
+#ifdef VM
+    {"bench-spt", test_bench_spt},
+#endif
 };
 
 static const char* test_name;
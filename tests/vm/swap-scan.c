@@ -0,0 +1,79 @@
+/* Mixes a hot anonymous working set with a cold sequential scan
+ * of a mapped file, to compare page replacement policies.  The
+ * hot set is read over and over while several mappings of
+ * large.txt are each read through once per round, so that the
+ * scan alone needs more memory than there is.  A policy that
+ * resists scans evicts the file pages and keeps the hot set.
+ *
+ * Compare the page fault counts the kernel prints when it powers
+ * off, with CLOCK and with the multi-generational LRU:
+ *     make tests/vm/swap-scan.result
+ *     make tests/vm/swap-scan.result KERNELFLAGS=-mglru
+ * For this test, Pintos memory size is 10MB */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define ONE_MB (1 << 20)  // 1MB
+#define HOT_SIZE (1 * ONE_MB)
+#define HOT_PAGES (HOT_SIZE / PAGE_SIZE)
+
+#define MAP_CNT 4         /* Mappings of large.txt. */
+#define MAP_SPACING (4 * ONE_MB)
+#define ROUND_CNT 3       /* Passes over the mappings. */
+#define HOT_INTERVAL 16   /* Scanned pages between passes over the hot set. */
+
+static char hot[HOT_SIZE];
+
+/* Reads the hot set, which must still hold what test_main()
+ * wrote to it. */
+static void touch_hot(void) {
+    size_t i;
+
+    for (i = 0; i < HOT_PAGES; i++)
+        if (hot[i * PAGE_SIZE] != (char)i) fail("hot page %zu is corrupt", i);
+}
+
+void test_main(void) {
+    char* base = (char*)0x10000000;
+    unsigned first_sum = 0;
+    size_t i, page_cnt;
+    int handle, size, m, round;
+
+    for (i = 0; i < HOT_PAGES; i++) hot[i * PAGE_SIZE] = (char)i;
+
+    CHECK((handle = open("large.txt")) > 1, "open \"large.txt\"");
+    size = filesize(handle);
+    page_cnt = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (m = 0; m < MAP_CNT; m++)
+        CHECK(mmap(base + m * MAP_SPACING, size, 0, handle, 0) != MAP_FAILED,
+              "mmap \"large.txt\" #%d", m);
+
+    for (round = 0; round < ROUND_CNT; round++)
+    {
+        msg("round %d", round);
+        for (m = 0; m < MAP_CNT; m++)
+        {
+            unsigned sum = 0;
+
+            for (i = 0; i < page_cnt; i++)
+            {
+                sum += (unsigned char)base[m * MAP_SPACING + i * PAGE_SIZE];
+                if (i % HOT_INTERVAL == 0) touch_hot();
+            }
+
+            /* The mappings all hold the same file. */
+            if (round == 0 && m == 0)
+                first_sum = sum;
+            else if (sum != first_sum)
+                fail("mapping %d read differently in round %d", m, round);
+        }
+    }
+
+    for (m = 0; m < MAP_CNT; m++) munmap(base + m * MAP_SPACING);
+    close(handle);
+}
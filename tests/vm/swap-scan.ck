@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(swap-scan) begin
+(swap-scan) open "large.txt"
+(swap-scan) mmap "large.txt" #0
+(swap-scan) mmap "large.txt" #1
+(swap-scan) mmap "large.txt" #2
+(swap-scan) mmap "large.txt" #3
+(swap-scan) round 0
+(swap-scan) round 1
+(swap-scan) round 2
+(swap-scan) end
+EOF
+pass;
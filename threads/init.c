@@ -20,7 +20,11 @@
 #include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
+#include "threads/smp.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vmalloc.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
@@ -71,6 +75,9 @@ int main(void) {
     /* Clear BSS and get machine's RAM size. */
     bss_init();
 
+    /* Set up this CPU's per-CPU data, which even printf() needs. */
+    smp_early_init();
+
     /* Break command line into arguments and parse options. */
     argv = read_command_line();
     argv = parse_options(argv);
@@ -83,7 +90,9 @@ int main(void) {
     /* Initialize memory system. */
     mem_end = palloc_init();
     malloc_init();
+    kmem_init();
     paging_init(mem_end);
+    vmalloc_init();
 
 #ifdef USERPROG
     tss_init();
@@ -101,9 +110,13 @@ int main(void) {
 #endif
     /* Start thread scheduler and enable interrupts. */
     thread_start();
+    palloc_start_zeroing();
     serial_init_queue();
     timer_calibrate();
 
+    /* Start the other CPUs, if any. */
+    smp_init();
+
 #ifdef FILESYS
     /* Initialize file system. */
     disk_init();
@@ -145,21 +158,40 @@ static void paging_init(uint64_t mem_end) {
     pml4 = base_pml4 = palloc_get_page(PAL_ASSERT | PAL_ZERO);
 
     extern char start, _end_kernel_text;
+    uint64_t text_start = (uint64_t)&start;
+    uint64_t text_end = (uint64_t)&_end_kernel_text;
+
     // Maps physical address [0 ~ mem_end] to
     //   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-    for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE)
+    // Uses 2 MB pages, except for 4 kB pages where a 2 MB page
+    // would straddle the edge of memory or of the read-only
+    // kernel text.
+    for (uint64_t pa = 0; pa < mem_end;)
     {
         uint64_t va = (uint64_t)ptov(pa);
+        uint64_t va_end = va + LARGE_PGSIZE;
 
         perm = PTE_P | PTE_W;
-        if ((uint64_t)&start <= va && va < (uint64_t)&_end_kernel_text)
-            perm &= ~PTE_W;
-
-        if ((pte = pml4e_walk(pml4, va, 1)) != NULL) *pte = pa | perm;
+        if (text_start <= va && va < text_end) perm &= ~PTE_W;
+
+        if (va % LARGE_PGSIZE == 0 && pa + LARGE_PGSIZE <= mem_end &&
+            !(va < text_start && text_start < va_end) &&
+            !(va < text_end && text_end < va_end))
+        {
+            if ((pte = pml4_pde_walk(pml4, va, 1)) != NULL)
+                *pte = pa | perm | PTE_PS;
+            pa += LARGE_PGSIZE;
+        }
+        else
+        {
+            if ((pte = pml4e_walk(pml4, va, 1)) != NULL) *pte = pa | perm;
+            pa += PGSIZE;
+        }
     }
 
     // reload cr3
     pml4_activate(0);
+    pcid_init();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -220,6 +252,10 @@ static char** parse_options(char** argv) {
             user_page_limit = atoi(value);
         else if (!strcmp(name, "-threads-tests"))
             thread_tests = true;
+#endif
+#ifdef VM
+        else if (!strcmp(name, "-mglru"))
+            vm_mglru = true;
 #endif
         else
             PANIC("unknown option `%s' (use -h for help)", name);
@@ -321,6 +357,9 @@ static void usage(void) {
         "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
         "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+        "  -mglru             Evict pages by multi-generational LRU.\n"
 #endif
     );
     power_off();
@@ -344,6 +383,8 @@ void power_off(void) {
 static void print_stats(void) {
     timer_print_stats();
     thread_print_stats();
+    palloc_print_stats();
+    kmem_cache_print_stats();
 #ifdef FILESYS
     disk_print_stats();
 #endif
@@ -352,4 +393,10 @@ static void print_stats(void) {
 #ifdef USERPROG
     exception_print_stats();
 #endif
+#ifdef VM
+    vm_print_stats();
+#endif
+#ifdef LOCKSTAT
+    lock_print_stats();
+#endif
 }
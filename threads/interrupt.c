@@ -9,6 +9,7 @@
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
 #include "threads/mmu.h"
+#include "threads/smp.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #ifdef USERPROG
@@ -94,13 +95,28 @@ static const char* intr_names[INTR_CNT];
    pre-empted.  Handlers for external interrupts also may not
    sleep, although they may invoke intr_yield_on_return() to
    request that a new process be scheduled just before the
-   interrupt returns. */
-static bool in_external_intr; /* Are we processing an external interrupt? */
-static bool yield_on_return;  /* Should we yield on interrupt return? */
+   interrupt returns.  Whether we are processing an external
+   interrupt, and whether we should yield on return, is kept per
+   CPU in struct cpu. */
+
+/* External vectors: 0x20...0x2f from the PIC or IOAPIC, and
+   0x30...0x3f from the local APIC. */
+#define is_external(vec) ((vec) >= 0x20 && (vec) < 0x40)
+
+/* Turning interrupts off only keeps this CPU's own interrupt
+   handlers out of a critical section.  Data that other CPUs touch
+   as well is protected by a spinlock, taken with interrupts off
+   if any interrupt handler takes it, too: each CPU's run queue by
+   its own lock (see thread.c), the timer wheel by another, and so
+   on. */
 
 /* Programmable Interrupt Controller helpers. */
 static void pic_init(void);
-static void pic_end_of_interrupt(int irq);
+static void pic_end_of_interrupt(int vec);
+
+/* Acknowledges external interrupt VEC.  The PIC does this until
+   intr_use_apic() is called. */
+static void (*end_of_interrupt)(int vec) = pic_end_of_interrupt;
 
 /* Interrupt handlers. */
 void intr_handler(struct intr_frame* args);
@@ -150,6 +166,22 @@ enum intr_level intr_disable(void) {
     return old_level;
 }
 
+/* Enables interrupts and waits for the next one to arrive.
+   Interrupts must be off on entry; they are on on return.
+
+   The `sti' instruction disables interrupts until the
+   completion of the next instruction, so `sti; hlt' is atomic
+   and an interrupt cannot slip in between re-enabling
+   interrupts and waiting for the next one.  See [IA32-v2a]
+   "HLT", [IA32-v2b] "STI", and [IA32-v3a] 7.11.1 "HLT
+   Instruction". */
+void intr_wait(void) {
+    ASSERT(intr_get_level() == INTR_OFF);
+    ASSERT(!intr_context());
+
+    asm volatile("sti; hlt" : : : "memory");
+}
+
 /* Initializes the interrupt system. */
 void intr_init(void) {
     int i;
@@ -194,6 +226,28 @@ void intr_init(void) {
     intr_names[19] = "#XF SIMD Floating-Point Exception";
 }
 
+/* Sets up interrupt handling on an application processor, which
+   is running with interrupts off: loads the IDT that intr_init()
+   built. */
+void intr_ap_init(void) {
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    lidt(&idt_desc);
+}
+
+/* Masks the PICs, whose interrupts are delivered through the
+   IOAPIC from now on, and acknowledges external interrupts by
+   calling EOI instead. */
+void intr_use_apic(void (*eoi)(int vec)) {
+    enum intr_level old_level = intr_disable();
+
+    outb(0x21, 0xff);
+    outb(0xa1, 0xff);
+    end_of_interrupt = eoi;
+
+    intr_set_level(old_level);
+}
+
 /* Registers interrupt VEC_NO to invoke HANDLER with descriptor
    privilege level DPL.  Names the interrupt NAME for debugging
    purposes.  The interrupt handler will be invoked with
@@ -222,7 +276,7 @@ static void register_handler(uint8_t vec_no,
 void intr_register_ext(uint8_t vec_no,
                        intr_handler_func* handler,
                        const char* name) {
-    ASSERT(vec_no >= 0x20 && vec_no <= 0x2f);
+    ASSERT(is_external(vec_no));
     register_handler(vec_no, 0, INTR_OFF, handler, name);
 }
 
@@ -244,13 +298,17 @@ void intr_register_int(uint8_t vec_no,
                        enum intr_level level,
                        intr_handler_func* handler,
                        const char* name) {
-    ASSERT(vec_no < 0x20 || vec_no > 0x2f);
+    ASSERT(!is_external(vec_no));
     register_handler(vec_no, dpl, level, handler, name);
 }
 
 /* Returns true during processing of an external interrupt
-   and false at all other times. */
-bool intr_context(void) { return in_external_intr; }
+   and false at all other times.  External interrupts always run
+   with interrupts off, which also keeps us from migrating between
+   reading cpu_current() and its flag. */
+bool intr_context(void) {
+    return intr_get_level() == INTR_OFF && cpu_current()->in_external_intr;
+}
 
 /* During processing of an external interrupt, directs the
    interrupt handler to yield to a new process just before
@@ -258,7 +316,7 @@ bool intr_context(void) { return in_external_intr; }
    time. */
 void intr_yield_on_return(void) {
     ASSERT(intr_context());
-    yield_on_return = true;
+    cpu_current()->yield_on_return = true;
 }
 
 /* 8259A Programmable Interrupt Controller. */
@@ -299,17 +357,17 @@ static void pic_init(void) {
     outb(0xa1, 0x00);
 }
 
-/* Sends an end-of-interrupt signal to the PIC for the given IRQ.
-   If we don't acknowledge the IRQ, it will never be delivered to
-   us again, so this is important.  */
-static void pic_end_of_interrupt(int irq) {
-    ASSERT(irq >= 0x20 && irq < 0x30);
+/* Sends an end-of-interrupt signal to the PIC for the given
+   vector.  If we don't acknowledge the IRQ, it will never be
+   delivered to us again, so this is important.  */
+static void pic_end_of_interrupt(int vec) {
+    ASSERT(vec >= 0x20 && vec < 0x30);
 
     /* Acknowledge master PIC. */
     outb(0x20, 0x20);
 
     /* Acknowledge slave PIC if this is a slave interrupt. */
-    if (irq >= 0x28) outb(0xa0, 0x20);
+    if (vec >= 0x28) outb(0xa0, 0x20);
 }
 /* Interrupt handlers. */
 
@@ -325,14 +383,14 @@ void intr_handler(struct intr_frame* frame) {
        We only handle one at a time (so interrupts must be off)
        and they need to be acknowledged on the PIC (see below).
        An external interrupt handler cannot sleep. */
-    external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
+    external = is_external(frame->vec_no);
     if (external)
     {
         ASSERT(intr_get_level() == INTR_OFF);
         ASSERT(!intr_context());
 
-        in_external_intr = true;
-        yield_on_return = false;
+        cpu_current()->in_external_intr = true;
+        cpu_current()->yield_on_return = false;
     }
 
     /* Invoke the interrupt's handler. */
@@ -359,10 +417,10 @@ void intr_handler(struct intr_frame* frame) {
         ASSERT(intr_get_level() == INTR_OFF);
         ASSERT(intr_context());
 
-        in_external_intr = false;
-        pic_end_of_interrupt(frame->vec_no);
+        cpu_current()->in_external_intr = false;
+        end_of_interrupt(frame->vec_no);
 
-        if (yield_on_return) thread_yield();
+        if (cpu_current()->yield_on_return) thread_yield();
     }
 }
 
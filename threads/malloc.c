@@ -7,98 +7,164 @@
 #include <string.h>
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "threads/vmalloc.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
-
-   Otherwise, a new page of memory, called an "arena", is
+   Each request, in bytes, is rounded up to the nearest of a set
+   of size classes, and assigned to the "descriptor" that manages
+   blocks of that size.  Classes are 16 bytes apart up to 256
+   bytes, and after that there are 8 classes per doubling, so
+   that no block is more than about 12.5% bigger than needed.
+
+   Blocks are carved out of page-sized "arenas".  Each arena's
+   header has a bitmap of its free blocks, and each descriptor
+   keeps a list of its arenas that have free blocks, so neither
+   allocating nor freeing touches the memory of any other block.
+   If a descriptor has no arena with a free block, a new one is
    obtained from the page allocator (if none is available,
-   malloc() returns a null pointer).  The new arena is divided
-   into blocks, all of which are added to the descriptor's free
-   list.  Then we return one of the new blocks.
-
-   When we free a block, we add it to its descriptor's free list.
-   But if the arena that the block was in now has no in-use
-   blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
-
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   malloc() returns a null pointer).  When an arena has no in-use
+   blocks left, we give it back to the page allocator.
+
+   Each descriptor has its own lock.  In addition, each thread
+   keeps a small "magazine" of blocks that it freed, which it
+   reuses for later requests of the same size class without
+   taking any lock.
+
+   We can't handle blocks bigger than about 2 kB using this
+   scheme, because they're too big to fit two to a page with an
+   arena header.  We handle those by allocating whole pages and
+   sticking the allocation size at the beginning of the allocated
+   block's arena header.  Blocks of more than one page come from
+   vmalloc(), so that they do not need physically contiguous
+   memory. */
 
 /* Descriptor. */
 struct desc {
     size_t block_size;       /* Size of each element in bytes. */
     size_t blocks_per_arena; /* Number of blocks in an arena. */
-    struct list free_list;   /* List of free blocks. */
+    struct list arenas;      /* Arenas with free blocks. */
     struct lock lock;        /* Lock. */
 };
 
 /* Magic number for detecting arena corruption. */
 #define ARENA_MAGIC 0x9a548eed
 
-/* Arena. */
+/* Most blocks an arena can hold. */
+#define ARENA_BLOCKS_MAX (PGSIZE / 16)
+
+/* Arena.  Aligned so that blocks after it are, too. */
 struct arena {
     unsigned magic;    /* Always set to ARENA_MAGIC. */
     struct desc* desc; /* Owning descriptor, null for big block. */
     size_t free_cnt;   /* Free blocks; pages in big block. */
-};
+    struct list_elem elem; /* Element in desc's arenas list. */
+    uint64_t free_map[ARENA_BLOCKS_MAX / 64]; /* Bit set if block free. */
+} __attribute__((aligned(16)));
 
-/* Free block. */
-struct block {
-    struct list_elem free_elem; /* Free list element. */
-};
+/* Block.  Its contents are entirely the caller's. */
+struct block;
 
 /* Our set of descriptors. */
-static struct desc descs[10]; /* Descriptors. */
+static struct desc descs[48]; /* Descriptors. */
 static size_t desc_cnt;       /* Number of descriptors. */
 
+/* Largest block size handled by a descriptor. */
+static size_t max_block_size;
+
+/* Index into descs[] of the smallest descriptor for requests
+   of N * 16 bytes, for N up to max_block_size / 16. */
+static uint8_t desc_of[PGSIZE / 16 + 1];
+
 static struct arena* block_to_arena(struct block*);
 static struct block* arena_to_block(struct arena*, size_t idx);
+static void free_block(struct desc*, struct block*);
 
 /* Initializes the malloc() descriptors. */
 void malloc_init(void) {
-    size_t block_size;
+    size_t block_size = 16;
+    size_t i;
 
-    for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
+    while ((PGSIZE - sizeof(struct arena)) / block_size >= 2)
     {
         struct desc* d = &descs[desc_cnt++];
+        size_t step = 16;
+
         ASSERT(desc_cnt <= sizeof descs / sizeof *descs);
         d->block_size = block_size;
         d->blocks_per_arena = (PGSIZE - sizeof(struct arena)) / block_size;
-        list_init(&d->free_list);
+        if (d->blocks_per_arena > ARENA_BLOCKS_MAX)
+            d->blocks_per_arena = ARENA_BLOCKS_MAX;
+        list_init(&d->arenas);
+        /* Left unnamed: one lock per size class would crowd the
+           lock statistics with identical rows. */
         lock_init(&d->lock);
+
+        /* Step by 1/8 of the power of 2 at or below BLOCK_SIZE. */
+        while (step * 16 <= block_size) step *= 2;
+        block_size += step;
+    }
+    max_block_size = descs[desc_cnt - 1].block_size;
+
+    for (i = 0; i * 16 <= max_block_size; i++)
+    {
+        size_t idx = i > 0 ? desc_of[i - 1] : 0;
+        while (descs[idx].block_size < i * 16) idx++;
+        desc_of[i] = idx;
     }
 }
 
+/* Takes a block of descriptor D from the current thread's
+   magazine and returns it, or returns a null pointer if there is
+   none. */
+static struct block* magazine_get(struct desc* d) {
+    struct magazine* m = &thread_current()->magazine;
+    uint8_t idx = d - descs;
+    int i;
+
+    for (i = m->cnt - 1; i >= 0; i--)
+        if (m->classes[i] == idx)
+        {
+            struct block* b = m->blocks[i];
+            m->cnt--;
+            m->blocks[i] = m->blocks[m->cnt];
+            m->classes[i] = m->classes[m->cnt];
+            return b;
+        }
+    return NULL;
+}
+
+/* Puts block B of descriptor D in the current thread's
+   magazine.  Returns false if the magazine is full. */
+static bool magazine_put(struct desc* d, struct block* b) {
+    struct magazine* m = &thread_current()->magazine;
+
+    if (m->cnt >= MAGAZINE_SIZE) return false;
+    m->blocks[m->cnt] = b;
+    m->classes[m->cnt] = d - descs;
+    m->cnt++;
+    return true;
+}
+
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void* malloc(size_t size) {
     struct desc* d;
     struct block* b;
     struct arena* a;
+    size_t idx;
 
     /* A null pointer satisfies a request for 0 bytes. */
     if (size == 0) return NULL;
 
-    /* Find the smallest descriptor that satisfies a SIZE-byte
-       request. */
-    for (d = descs; d < descs + desc_cnt; d++)
-        if (d->block_size >= size) break;
-    if (d == descs + desc_cnt)
+    if (size > max_block_size)
     {
         /* SIZE is too big for any descriptor.
            Allocate enough pages to hold SIZE plus an arena. */
         size_t page_cnt = DIV_ROUND_UP(size + sizeof *a, PGSIZE);
-        a = palloc_get_multiple(0, page_cnt);
+        a = page_cnt > 1 ? vmalloc(page_cnt * PGSIZE) : palloc_get_page(0);
         if (a == NULL) return NULL;
 
         /* Initialize the arena to indicate a big block of PAGE_CNT
@@ -109,13 +175,17 @@ void* malloc(size_t size) {
         return a + 1;
     }
 
+    /* Find the smallest descriptor that satisfies a SIZE-byte
+       request, and try the magazine first. */
+    d = &descs[desc_of[DIV_ROUND_UP(size, 16)]];
+    b = magazine_get(d);
+    if (b != NULL) return b;
+
     lock_acquire(&d->lock);
 
-    /* If the free list is empty, create a new arena. */
-    if (list_empty(&d->free_list))
+    /* If no arena has a free block, create a new arena. */
+    if (list_empty(&d->arenas))
     {
-        size_t i;
-
         /* Allocate a page. */
         a = palloc_get_page(0);
         if (a == NULL)
@@ -124,23 +194,24 @@ void* malloc(size_t size) {
             return NULL;
         }
 
-        /* Initialize arena and add its blocks to the free list. */
+        /* Initialize arena and mark all of its blocks free. */
         a->magic = ARENA_MAGIC;
         a->desc = d;
         a->free_cnt = d->blocks_per_arena;
-        for (i = 0; i < d->blocks_per_arena; i++)
-        {
-            struct block* b = arena_to_block(a, i);
-            list_push_back(&d->free_list, &b->free_elem);
-        }
+        memset(a->free_map, 0, sizeof a->free_map);
+        for (idx = 0; idx < d->blocks_per_arena; idx++)
+            a->free_map[idx / 64] |= (uint64_t)1 << (idx % 64);
+        list_push_front(&d->arenas, &a->elem);
     }
 
-    /* Get a block from free list and return it. */
-    b = list_entry(list_pop_front(&d->free_list), struct block, free_elem);
-    a = block_to_arena(b);
-    a->free_cnt--;
+    /* Get the first free block of the first arena and return it. */
+    a = list_entry(list_front(&d->arenas), struct arena, elem);
+    for (idx = 0; a->free_map[idx] == 0; idx++) continue;
+    idx = idx * 64 + __builtin_ctzll(a->free_map[idx]);
+    a->free_map[idx / 64] &= ~((uint64_t)1 << (idx % 64));
+    if (--a->free_cnt == 0) list_remove(&a->elem);
     lock_release(&d->lock);
-    return b;
+    return arena_to_block(a, idx);
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -213,36 +284,56 @@ void free(void* p) {
             memset(b, 0xcc, d->block_size);
 #endif
 
-            lock_acquire(&d->lock);
-
-            /* Add block to free list. */
-            list_push_front(&d->free_list, &b->free_elem);
-
-            /* If the arena is now entirely unused, free it. */
-            if (++a->free_cnt >= d->blocks_per_arena)
-            {
-                size_t i;
-
-                ASSERT(a->free_cnt == d->blocks_per_arena);
-                for (i = 0; i < d->blocks_per_arena; i++)
-                {
-                    struct block* b = arena_to_block(a, i);
-                    list_remove(&b->free_elem);
-                }
-                palloc_free_page(a);
-            }
-
-            lock_release(&d->lock);
+            if (!magazine_put(d, b)) free_block(d, b);
         }
         else
         {
             /* It's a big block.  Free its pages. */
-            palloc_free_multiple(a, a->free_cnt);
+            if (is_vmalloc_vaddr(a))
+                vfree(a);
+            else
+                palloc_free_page(a);
             return;
         }
     }
 }
 
+/* Returns the blocks in the current thread's magazine to their
+   arenas.  Called when the thread exits. */
+void malloc_thread_exit(void) {
+    struct magazine* m = &thread_current()->magazine;
+
+    while (m->cnt > 0)
+    {
+        m->cnt--;
+        free_block(&descs[m->classes[m->cnt]], m->blocks[m->cnt]);
+    }
+}
+
+/* Returns block B of descriptor D to its arena. */
+static void free_block(struct desc* d, struct block* b) {
+    struct arena* a = block_to_arena(b);
+    size_t idx = (pg_ofs(b) - sizeof *a) / d->block_size;
+    uint64_t bit = (uint64_t)1 << (idx % 64);
+
+    lock_acquire(&d->lock);
+
+    /* Mark block free in its arena. */
+    ASSERT(!(a->free_map[idx / 64] & bit));
+    a->free_map[idx / 64] |= bit;
+    if (a->free_cnt++ == 0) list_push_front(&d->arenas, &a->elem);
+
+    /* If the arena is now entirely unused, free it. */
+    if (a->free_cnt >= d->blocks_per_arena)
+    {
+        ASSERT(a->free_cnt == d->blocks_per_arena);
+        list_remove(&a->elem);
+        palloc_free_page(a);
+    }
+
+    lock_release(&d->lock);
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena* block_to_arena(struct block* b) {
     struct arena* a = pg_round_down(b);
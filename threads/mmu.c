@@ -4,6 +4,7 @@
 #include <string.h>
 #include "intrinsic.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
@@ -12,6 +13,9 @@ static uint64_t* pgdir_walk(uint64_t* pdp, const uint64_t va, int create) {
     int idx = PDX(va);
     if (pdp)
     {
+        /* A 2 MB page has no page table. */
+        if (pdp[idx] & PTE_PS) return NULL;
+
         uint64_t* pte = (uint64_t*)pdp[idx];
         if (!((uint64_t)pte & PTE_P))
         {
@@ -103,13 +107,136 @@ uint64_t* pml4e_walk(uint64_t* pml4e, const uint64_t va, int create) {
     return pte;
 }
 
+/* Returns the page directory entry for virtual address VA in
+ * page map level 4 PML4, which either maps a 2 MB page or points
+ * to a page table.  If PML4 has no page directory for VA, then
+ * one is created if CREATE is true, otherwise a null pointer is
+ * returned. */
+uint64_t* pml4_pde_walk(uint64_t* pml4, const uint64_t va, int create) {
+    uint64_t* table = pml4;
+    int idx[2] = {PML4(va), PDPE(va)};
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (!(table[idx[i]] & PTE_P))
+        {
+            uint64_t* new_page;
+
+            if (!create) return NULL;
+            new_page = palloc_get_page(PAL_ZERO);
+            if (new_page == NULL) return NULL;
+            table[idx[i]] = vtop(new_page) | PTE_U | PTE_W | PTE_P;
+        }
+        table = ptov(PTE_ADDR(table[idx[i]]));
+    }
+    return &table[PDX(va)];
+}
+
+/* Process-context identifiers (PCIDs).
+ *
+ * When the CPU supports them, each user pml4 gets its own PCID, so
+ * that switching to it does not flush the TLB entries of other
+ * address spaces, which may then still be valid when we switch
+ * back.  base_pml4 uses PCID 0, as does any pml4 created when all
+ * other PCIDs are taken; loading such a pml4 flushes the TLB
+ * entries of PCID 0, as before.
+ *
+ * A pml4's PCID is kept in one of its not-present entries, whose
+ * other bits the CPU ignores.  Only the BSP enables PCIDs, since
+ * user processes only run there. */
+#define PCID_CNT 4096          /* Number of PCIDs. */
+#define PML4_PCID_IDX 511      /* Entry of a pml4 that holds its PCID. */
+#define CR3_NOFLUSH (1UL << 63) /* Keep TLB entries of the new PCID. */
+#define CR4_PCIDE (1 << 17)    /* Enable PCIDs. */
+
+/* INVPCID types. */
+#define INVPCID_ADDR 0   /* One address in one PCID. */
+#define INVPCID_SINGLE 1 /* All of one PCID. */
+#define INVPCID_ALL 3    /* All PCIDs, except global pages. */
+
+static bool pcid_enabled;
+static uint64_t pcid_used[PCID_CNT / 64]; /* Bit set if PCID in use. */
+
+/* Enables PCIDs if the CPU supports both them and INVPCID. */
+void pcid_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    bool has_pcid, has_invpcid;
+
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    has_pcid = ecx & (1 << 17);
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    has_invpcid = false;
+    if (eax >= 7)
+    {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        has_invpcid = ebx & (1 << 10);
+    }
+    if (!has_pcid || !has_invpcid) return;
+
+    /* CR3 must select PCID 0 when enabling PCIDs. */
+    ASSERT(pg_ofs(rcr3()) == 0);
+    lcr4(rcr4() | CR4_PCIDE);
+    pcid_used[0] = 1;
+    pcid_enabled = true;
+}
+
+/* Returns a free PCID, marked as used, or 0 if there is none. */
+static uint16_t pcid_alloc(void) {
+    enum intr_level old_level = intr_disable();
+    uint16_t pcid = 0;
+
+    for (size_t i = 0; i < PCID_CNT / 64; i++)
+        if (~pcid_used[i] != 0)
+        {
+            int bit = __builtin_ctzll(~pcid_used[i]);
+            pcid_used[i] |= 1UL << bit;
+            pcid = i * 64 + bit;
+            break;
+        }
+    intr_set_level(old_level);
+    return pcid;
+}
+
+/* Returns the PCID of PML4. */
+static uint16_t pml4_pcid(const uint64_t* pml4) {
+    return pml4[PML4_PCID_IDX] >> 1;
+}
+
+/* Flushes every TLB entry for PCID 0 and, if PCIDs are enabled,
+ * for every other PCID. */
+void tlb_flush_all(void) {
+    if (pcid_enabled)
+        invpcid(INVPCID_ALL, 0, 0);
+    else
+        lcr3(rcr3());
+}
+
+/* Invalidates the TLB entry for virtual page VPAGE in PML4. */
+static void pml4_invalidate(uint64_t* pml4, const void* vpage) {
+    if (PTE_ADDR(rcr3()) == vtop(pml4))
+        invlpg((uint64_t)vpage);
+    else if (pml4_pcid(pml4) != 0)
+        invpcid(INVPCID_ADDR, pml4_pcid(pml4), (uint64_t)vpage);
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
  * allocation fails. */
 uint64_t* pml4_create(void) {
     uint64_t* pml4 = palloc_get_page(0);
-    if (pml4) memcpy(pml4, base_pml4, PGSIZE);
+    if (pml4)
+    {
+        memcpy(pml4, base_pml4, PGSIZE);
+        if (pcid_enabled)
+        {
+            uint16_t pcid = pcid_alloc();
+
+            /* Drop anything left over from the PCID's last user. */
+            if (pcid != 0) invpcid(INVPCID_SINGLE, pcid, 0);
+            pml4[PML4_PCID_IDX] = (uint64_t)pcid << 1;
+        }
+    }
     return pml4;
 }
 
@@ -142,7 +269,8 @@ static bool pgdir_for_each(uint64_t* pdp,
     for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t*); i++)
     {
         uint64_t* pte = ptov((uint64_t*)pdp[i]);
-        if (((uint64_t)pte) & PTE_P)
+        /* Skip 2 MB pages, which only the kernel's direct map uses. */
+        if ((((uint64_t)pte) & PTE_P) && !(pdp[i] & PTE_PS))
             if (!pt_for_each((uint64_t*)PTE_ADDR(pte), func, aux, pml4_index,
                              pdp_index, i))
                 return false;
@@ -177,47 +305,70 @@ bool pml4_for_each(uint64_t* pml4, pte_for_each_func* func, void* aux) {
     return true;
 }
 
-static void pt_destroy(uint64_t* pt) {
+static void pt_destroy(struct mmu_gather* tlb, uint64_t* pt) {
     for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t*); i++)
     {
         uint64_t* pte = ptov((uint64_t*)pt[i]);
-        if (((uint64_t)pte) & PTE_P) palloc_free_page((void*)PTE_ADDR(pte));
+        if (((uint64_t)pte) & PTE_P)
+            mmu_gather_free_page(tlb, (void*)PTE_ADDR(pte));
     }
-    palloc_free_page((void*)pt);
+    mmu_gather_free_page(tlb, (void*)pt);
 }
 
-static void pgdir_destroy(uint64_t* pdp) {
+static void pgdir_destroy(struct mmu_gather* tlb, uint64_t* pdp) {
     for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t*); i++)
     {
         uint64_t* pte = ptov((uint64_t*)pdp[i]);
-        if (((uint64_t)pte) & PTE_P) pt_destroy(PTE_ADDR(pte));
+        if (((uint64_t)pte) & PTE_P) pt_destroy(tlb, PTE_ADDR(pte));
     }
-    palloc_free_page((void*)pdp);
+    mmu_gather_free_page(tlb, (void*)pdp);
 }
 
-static void pdpe_destroy(uint64_t* pdpe) {
+static void pdpe_destroy(struct mmu_gather* tlb, uint64_t* pdpe) {
     for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t*); i++)
     {
         uint64_t* pde = ptov((uint64_t*)pdpe[i]);
-        if (((uint64_t)pde) & PTE_P) pgdir_destroy((void*)PTE_ADDR(pde));
+        if (((uint64_t)pde) & PTE_P)
+            pgdir_destroy(tlb, (void*)PTE_ADDR(pde));
     }
-    palloc_free_page((void*)pdpe);
+    mmu_gather_free_page(tlb, (void*)pdpe);
 }
 
 /* Destroys pml4e, freeing all the pages it references. */
 void pml4_destroy(uint64_t* pml4) {
+    struct mmu_gather tlb;
+
     if (pml4 == NULL) return;
     ASSERT(pml4 != base_pml4);
 
     /* if PML4 (vaddr) >= 1, it's kernel space by define. */
+    mmu_gather_init(&tlb, pml4, true);
     uint64_t* pdpe = ptov((uint64_t*)pml4[0]);
-    if (((uint64_t)pdpe) & PTE_P) pdpe_destroy((void*)PTE_ADDR(pdpe));
+    if (((uint64_t)pdpe) & PTE_P) pdpe_destroy(&tlb, (void*)PTE_ADDR(pdpe));
+    mmu_gather_finish(&tlb);
+
+    uint16_t pcid = pml4_pcid(pml4);
+    if (pcid != 0)
+    {
+        enum intr_level old_level = intr_disable();
+        pcid_used[pcid / 64] &= ~(1UL << (pcid % 64));
+        intr_set_level(old_level);
+    }
     palloc_free_page((void*)pml4);
 }
 
 /* Loads page directory PD into the CPU's page directory base
- * register. */
-void pml4_activate(uint64_t* pml4) { lcr3(vtop(pml4 ? pml4 : base_pml4)); }
+ * register, unless it is already loaded. */
+void pml4_activate(uint64_t* pml4) {
+    uint64_t cr3;
+
+    if (pml4 == NULL) pml4 = base_pml4;
+    cr3 = vtop(pml4);
+    if (PTE_ADDR(rcr3()) == cr3) return;
+
+    if (pml4_pcid(pml4) != 0) cr3 |= pml4_pcid(pml4) | CR3_NOFLUSH;
+    lcr3(cr3);
+}
 
 /* Looks up the physical address that corresponds to user virtual
  * address UADDR in pml4.  Returns the kernel virtual address
@@ -266,7 +417,7 @@ void pml4_clear_page(uint64_t* pml4, void* upage) {
     if (pte != NULL && (*pte & PTE_P) != 0)
     {
         *pte &= ~PTE_P;
-        if (rcr3() == vtop(pml4)) invlpg((uint64_t)upage);
+        pml4_invalidate(pml4, upage);
     }
 }
 
@@ -290,7 +441,7 @@ void pml4_set_dirty(uint64_t* pml4, const void* vpage, bool dirty) {
         else
             *pte &= ~(uint32_t)PTE_D;
 
-        if (rcr3() == vtop(pml4)) invlpg((uint64_t)vpage);
+        pml4_invalidate(pml4, vpage);
     }
 }
 
@@ -314,6 +465,94 @@ void pml4_set_accessed(uint64_t* pml4, const void* vpage, bool accessed) {
         else
             *pte &= ~(uint32_t)PTE_A;
 
-        if (rcr3() == vtop(pml4)) invlpg((uint64_t)vpage);
+        pml4_invalidate(pml4, vpage);
     }
 }
+
+/* Batched unmapping.
+ *
+ * Clearing pages one at a time with pml4_clear_page() flushes each
+ * page's TLB entry as it goes.  An mmu_gather instead clears the
+ * PTEs of a whole range, flushes once at the end, and frees the
+ * pages that were mapped, or that held page tables, only after
+ * that flush, so that no stale TLB entry can reach a page that
+ * has been reused.  Up to MMU_GATHER_FLUSH_MAX pages are flushed
+ * one by one; a larger range flushes all of the pml4's entries.
+ *
+ * A "fullmm" gather tears down an entire pml4 that is no longer
+ * active.  It needs no flush at all: loading another pml4 has
+ * already dropped its entries, or, with PCIDs, they are dropped
+ * when its PCID is next handed out. */
+#define MMU_GATHER_FLUSH_MAX 32
+
+/* Initializes TLB to gather changes to PML4.  FULLMM is true if
+ * PML4 is about to be destroyed. */
+void mmu_gather_init(struct mmu_gather* tlb, uint64_t* pml4, bool fullmm) {
+    ASSERT(!fullmm || PTE_ADDR(rcr3()) != vtop(pml4));
+
+    tlb->pml4 = pml4;
+    tlb->fullmm = fullmm;
+    tlb->start = UINT64_MAX;
+    tlb->end = 0;
+    tlb->page_cnt = 0;
+}
+
+/* Flushes the TLB entries of every page TLB has cleared so far. */
+static void mmu_gather_flush(struct mmu_gather* tlb) {
+    if (tlb->start >= tlb->end) return;
+
+    if (tlb->fullmm)
+        ;
+    else if ((tlb->end - tlb->start) / PGSIZE <= MMU_GATHER_FLUSH_MAX)
+    {
+        for (uint64_t va = tlb->start; va < tlb->end; va += PGSIZE)
+            pml4_invalidate(tlb->pml4, (void*)va);
+    }
+    else if (PTE_ADDR(rcr3()) == vtop(tlb->pml4))
+        /* Without the NOFLUSH bit, this drops the entries of the
+         * current PCID. */
+        lcr3(rcr3());
+    else if (pml4_pcid(tlb->pml4) != 0)
+        invpcid(INVPCID_SINGLE, pml4_pcid(tlb->pml4), 0);
+
+    tlb->start = UINT64_MAX;
+    tlb->end = 0;
+}
+
+/* Flushes the TLB and frees the pages gathered in TLB. */
+static void mmu_gather_free_batch(struct mmu_gather* tlb) {
+    mmu_gather_flush(tlb);
+    palloc_free_pages(tlb->pages, tlb->page_cnt);
+    tlb->page_cnt = 0;
+}
+
+/* Marks user virtual page UPAGE "not present" in TLB's pml4, like
+ * pml4_clear_page(), but leaves its TLB entry until the next flush.
+ * Returns the kernel virtual address of the page UPAGE mapped, or a
+ * null pointer if UPAGE was not mapped.  The caller may hand that
+ * page to mmu_gather_free_page(). */
+void* mmu_gather_clear_page(struct mmu_gather* tlb, void* upage) {
+    uint64_t* pte;
+    ASSERT(pg_ofs(upage) == 0);
+    ASSERT(is_user_vaddr(upage));
+
+    pte = pml4e_walk(tlb->pml4, (uint64_t)upage, false);
+    if (pte == NULL || (*pte & PTE_P) == 0) return NULL;
+
+    *pte &= ~PTE_P;
+    if ((uint64_t)upage < tlb->start) tlb->start = (uint64_t)upage;
+    if ((uint64_t)upage + PGSIZE > tlb->end)
+        tlb->end = (uint64_t)upage + PGSIZE;
+    return ptov(PTE_ADDR(*pte));
+}
+
+/* Frees page KPAGE, obtained from palloc_get_page(), once the TLB
+ * no longer holds entries for any page TLB has cleared. */
+void mmu_gather_free_page(struct mmu_gather* tlb, void* kpage) {
+    tlb->pages[tlb->page_cnt++] = kpage;
+    if (tlb->page_cnt == MMU_GATHER_BATCH) mmu_gather_free_batch(tlb);
+}
+
+/* Flushes the TLB for the pages TLB has cleared and frees the
+ * pages it still holds. */
+void mmu_gather_finish(struct mmu_gather* tlb) { mmu_gather_free_batch(tlb); }
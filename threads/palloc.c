@@ -2,6 +2,7 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -10,6 +11,7 @@
 #include "threads/init.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -24,15 +26,52 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a binary buddy allocator.  Free memory is kept as
+   blocks of 2**N pages, aligned to their size relative to the
+   pool base, on one free list per order N.  Allocating takes a
+   block from the smallest order that fits and splits it in
+   halves as needed; freeing merges a block with its "buddy", the
+   other half of the block it was split from, as long as that is
+   free too.  Both take O(log n) steps.  A request for a page
+   count that is not a power of 2 gets the rest of its block
+   returned to the free lists right away, so callers still free
+   exactly the pages they asked for.
+
+   A low-priority kernel thread also keeps a few zeroed pages on
+   hand in each pool, so that single-page PAL_ZERO requests, such
+   as for page tables and zero-filled user pages, usually need not
+   clear memory themselves.  Zeroed pages count as allocated as
+   far as the buddy allocator is concerned; they go back to it if
+   an allocation would otherwise fail. */
+
+/* Number of block orders: blocks of 1 to 2**20 pages (4 GB). */
+#define ORDER_CNT 21
+
+/* Number of zeroed pages to keep in each pool. */
+#define ZEROED_MAX 64
 
 /* A memory pool. */
 struct pool {
     struct lock lock;        /* Mutual exclusion. */
-    struct bitmap* used_map; /* Bitmap of free pages. */
-    uint8_t* base;           /* Base of pool. */
+    struct bitmap* used_map; /* Bitmap of allocated pages. */
+    uint8_t* orders;         /* Order + 1 for the first page of each
+                                free block, 0 for other pages. */
+    struct list free_lists[ORDER_CNT]; /* Free blocks by order. */
+    struct list zeroed;                /* Zeroed pages. */
+    size_t zeroed_cnt;                 /* Number of zeroed pages. */
+    uint64_t zeroed_hits;              /* PAL_ZERO pages taken from zeroed. */
+    uint64_t zeroed_misses;            /* PAL_ZERO pages zeroed inline. */
+    uint8_t* base;                     /* Base of pool. */
 };
 
+/* Upped when a pool runs low on zeroed pages while the zeroer is
+   asleep.  Only whoever clears zeroer_asleep ups it, so its value
+   never exceeds 1. */
+static struct semaphore zeroed_wanted;
+static bool zeroer_asleep;
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
@@ -44,6 +83,12 @@ static void init_pool(struct pool* p,
                       uint64_t end);
 
 static bool page_from_pool(const struct pool*, void* page);
+static size_t page_index(const struct pool*, const void* page);
+static void add_free_pages(struct pool*, size_t page_idx, size_t page_cnt);
+static size_t alloc_pages(struct pool*, size_t page_cnt);
+static void free_pages(struct pool*, size_t page_idx, size_t page_cnt);
+static void* take_zeroed_page(struct pool*);
+static void release_zeroed_pages(struct pool*);
 
 /* multiboot info */
 struct multiboot_info {
@@ -200,6 +245,8 @@ static void populate_pools(struct area* base_mem, struct area* ext_mem) {
 
     // generate the user pool
     init_pool(&user_pool, &free_start, region_start, end);
+    lock_set_name(&kernel_pool.lock, "kernel pool");
+    lock_set_name(&user_pool.lock, "user pool");
 
     // Iterate over the e820_entry. Setup the usable.
     uint64_t usable_bound = (uint64_t)free_start;
@@ -236,14 +283,14 @@ static void populate_pools(struct area* base_mem, struct area* ext_mem) {
             if ((uint64_t)pool_end < end)
             {
                 page_cnt = ((uint64_t)pool_end - start) / PGSIZE;
-                bitmap_set_multiple(pool->used_map, page_idx, page_cnt, false);
+                add_free_pages(pool, page_idx, page_cnt);
                 start = (uint64_t)pool_end;
                 goto split;
             }
             else
             {
                 page_cnt = ((uint64_t)end - start) / PGSIZE;
-                bitmap_set_multiple(pool->used_map, page_idx, page_cnt, false);
+                add_free_pages(pool, page_idx, page_cnt);
             }
         }
     }
@@ -257,6 +304,7 @@ uint64_t palloc_init(void) {
     struct area base_mem = {.size = 0};
     struct area ext_mem = {.size = 0};
 
+    sema_init(&zeroed_wanted, 0);
     resolve_area_info(&base_mem, &ext_mem);
     printf("Pintos booting with: \n");
     printf("\tbase_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n", base_mem.start,
@@ -276,8 +324,21 @@ uint64_t palloc_init(void) {
 void* palloc_get_multiple(enum palloc_flags flags, size_t page_cnt) {
     struct pool* pool = flags & PAL_USER ? &user_pool : &kernel_pool;
 
+    if ((flags & PAL_ZERO) && page_cnt == 1)
+    {
+        void* page = take_zeroed_page(pool);
+        if (page != NULL) return page;
+    }
+
     lock_acquire(&pool->lock);
-    size_t page_idx = bitmap_scan_and_flip(pool->used_map, 0, page_cnt, false);
+    size_t page_idx = alloc_pages(pool, page_cnt);
+    if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0)
+    {
+        release_zeroed_pages(pool);
+        page_idx = alloc_pages(pool, page_cnt);
+    }
+    if ((flags & PAL_ZERO) && page_idx != BITMAP_ERROR)
+        pool->zeroed_misses += page_cnt;
     lock_release(&pool->lock);
     void* pages;
 
@@ -329,13 +390,50 @@ void palloc_free_multiple(void* pages, size_t page_cnt) {
 #ifndef NDEBUG
     memset(pages, 0xcc, PGSIZE * page_cnt);
 #endif
+    lock_acquire(&pool->lock);
     ASSERT(bitmap_all(pool->used_map, page_idx, page_cnt));
     bitmap_set_multiple(pool->used_map, page_idx, page_cnt, false);
+    free_pages(pool, page_idx, page_cnt);
+    lock_release(&pool->lock);
 }
 
 /* Frees the page at PAGE. */
 void palloc_free_page(void* page) { palloc_free_multiple(page, 1); }
 
+/* Frees the CNT pages in PAGES, each a single page, taking each
+   pool's lock only once. */
+void palloc_free_pages(void** pages, size_t cnt) {
+    struct pool* pools[] = {&kernel_pool, &user_pool};
+    size_t i, p;
+
+#ifndef NDEBUG
+    for (i = 0; i < cnt; i++) memset(pages[i], 0xcc, PGSIZE);
+#endif
+    for (p = 0; p < sizeof pools / sizeof *pools; p++)
+    {
+        struct pool* pool = pools[p];
+        bool locked = false;
+
+        for (i = 0; i < cnt; i++)
+        {
+            size_t page_idx;
+
+            ASSERT(pg_ofs(pages[i]) == 0);
+            if (!page_from_pool(pool, pages[i])) continue;
+            if (!locked)
+            {
+                lock_acquire(&pool->lock);
+                locked = true;
+            }
+            page_idx = page_index(pool, pages[i]);
+            ASSERT(bitmap_test(pool->used_map, page_idx));
+            bitmap_reset(pool->used_map, page_idx);
+            free_pages(pool, page_idx, 1);
+        }
+        if (locked) lock_release(&pool->lock);
+    }
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void init_pool(struct pool* p,
                       void** bm_base,
@@ -346,15 +444,23 @@ static void init_pool(struct pool* p,
        and subtract it from the pool's size. */
     uint64_t pgcnt = (end - start) / PGSIZE;
     size_t bm_pages = DIV_ROUND_UP(bitmap_buf_size(pgcnt), PGSIZE) * PGSIZE;
+    size_t order_pages = DIV_ROUND_UP(pgcnt, PGSIZE) * PGSIZE;
+    int order;
 
     lock_init(&p->lock);
     p->used_map = bitmap_create_in_buf(pgcnt, *bm_base, bm_pages);
+    p->orders = *bm_base + bm_pages;
+    for (order = 0; order < ORDER_CNT; order++) list_init(&p->free_lists[order]);
+    list_init(&p->zeroed);
+    p->zeroed_cnt = 0;
+    p->zeroed_hits = p->zeroed_misses = 0;
     p->base = (void*)start;
 
     // Mark all to unusable.
     bitmap_set_all(p->used_map, true);
+    memset(p->orders, 0, pgcnt);
 
-    *bm_base += bm_pages;
+    *bm_base += bm_pages + order_pages;
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -365,3 +471,227 @@ static bool page_from_pool(const struct pool* pool, void* page) {
     size_t end_page = start_page + bitmap_size(pool->used_map);
     return page_no >= start_page && page_no < end_page;
 }
+
+/* Returns the index within POOL of the page at PAGE. */
+static size_t page_index(const struct pool* pool, const void* page) {
+    return ((const uint8_t*)page - pool->base) / PGSIZE;
+}
+
+/* Puts the free block of 2**ORDER pages at PAGE_IDX in POOL on
+   its free list.  The list element lives in the block itself. */
+static void push_block(struct pool* pool, size_t page_idx, int order) {
+    struct list_elem* e = (struct list_elem*)(pool->base + page_idx * PGSIZE);
+
+    pool->orders[page_idx] = order + 1;
+    list_push_front(&pool->free_lists[order], e);
+}
+
+/* Takes the free block at PAGE_IDX in POOL off its free list. */
+static void remove_block(struct pool* pool, size_t page_idx) {
+    list_remove((struct list_elem*)(pool->base + page_idx * PGSIZE));
+    pool->orders[page_idx] = 0;
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX in POOL, merging
+   it with its buddy for as long as that is free. */
+static void free_block(struct pool* pool, size_t page_idx, int order) {
+    while (order < ORDER_CNT - 1)
+    {
+        size_t buddy = page_idx ^ ((size_t)1 << order);
+
+        if (buddy >= bitmap_size(pool->used_map) ||
+            pool->orders[buddy] != order + 1)
+            break;
+        remove_block(pool, buddy);
+        page_idx &= ~((size_t)1 << order);
+        order++;
+    }
+    push_block(pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages at PAGE_IDX in POOL, as the largest
+   aligned blocks that they can be split into. */
+static void free_pages(struct pool* pool, size_t page_idx, size_t page_cnt) {
+    while (page_cnt > 0)
+    {
+        int order = 0;
+
+        while (order < ORDER_CNT - 1 &&
+               (page_idx & ((size_t)1 << order)) == 0 &&
+               ((size_t)2 << order) <= page_cnt)
+            order++;
+        free_block(pool, page_idx, order);
+        page_idx += (size_t)1 << order;
+        page_cnt -= (size_t)1 << order;
+    }
+}
+
+/* Makes the PAGE_CNT pages at PAGE_IDX in POOL available, at
+   initialization time. */
+static void add_free_pages(struct pool* pool,
+                           size_t page_idx,
+                           size_t page_cnt) {
+    bitmap_set_multiple(pool->used_map, page_idx, page_cnt, false);
+    free_pages(pool, page_idx, page_cnt);
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if there is no free block
+   large enough.  POOL's lock must be held. */
+static size_t alloc_pages(struct pool* pool, size_t page_cnt) {
+    struct list_elem* e;
+    size_t page_idx;
+    int need = 0;
+    int order;
+
+    while (((size_t)1 << need) < page_cnt) need++;
+    for (order = need; order < ORDER_CNT; order++)
+        if (!list_empty(&pool->free_lists[order])) break;
+    if (order >= ORDER_CNT) return BITMAP_ERROR;
+
+    e = list_pop_front(&pool->free_lists[order]);
+    page_idx = page_index(pool, e);
+    pool->orders[page_idx] = 0;
+
+    /* Split off the upper halves that we do not need. */
+    while (order > need)
+    {
+        order--;
+        push_block(pool, page_idx + ((size_t)1 << order), order);
+    }
+
+    /* Give back the pages past PAGE_CNT. */
+    if (((size_t)1 << need) > page_cnt)
+        free_pages(pool, page_idx + page_cnt, ((size_t)1 << need) - page_cnt);
+
+    ASSERT(bitmap_none(pool->used_map, page_idx, page_cnt));
+    bitmap_set_multiple(pool->used_map, page_idx, page_cnt, true);
+    return page_idx;
+}
+
+/* Prints the free blocks of each order in POOL and how badly its
+   free memory is fragmented, that is, how much of it lies outside
+   the largest free block. */
+static void print_pool_stats(const char* name, struct pool* pool) {
+    size_t free_cnt = 0;
+    size_t largest = 0;
+    int order;
+
+    lock_acquire(&pool->lock);
+    printf("%s pool: free blocks by order:", name);
+    for (order = 0; order < ORDER_CNT; order++)
+    {
+        size_t block_cnt = list_size(&pool->free_lists[order]);
+
+        if (block_cnt == 0) continue;
+        printf(" %d:%zu", order, block_cnt);
+        free_cnt += block_cnt << order;
+        largest = (size_t)1 << order;
+    }
+    lock_release(&pool->lock);
+
+    printf("\n%s pool: %zu of %zu pages free, largest free block %zu pages, "
+           "%zu%% fragmented\n",
+           name, free_cnt, bitmap_size(pool->used_map), largest,
+           free_cnt > 0 ? 100 - largest * 100 / free_cnt : 0);
+    printf("%s pool: %zu zeroed pages, %" PRIu64 " zeroed in advance, %" PRIu64
+           " inline\n",
+           name, pool->zeroed_cnt, pool->zeroed_hits, pool->zeroed_misses);
+}
+
+/* Prints page allocator statistics. */
+void palloc_print_stats(void) {
+    print_pool_stats("Kernel", &kernel_pool);
+    print_pool_stats("User", &user_pool);
+}
+
+/* Takes a page from POOL's zeroed pages and returns it, or
+   returns a null pointer if there is none. */
+static void* take_zeroed_page(struct pool* pool) {
+    struct list_elem* e = NULL;
+    bool low;
+
+    lock_acquire(&pool->lock);
+    if (!list_empty(&pool->zeroed))
+    {
+        e = list_pop_front(&pool->zeroed);
+        pool->zeroed_cnt--;
+        pool->zeroed_hits++;
+    }
+    low = pool->zeroed_cnt < ZEROED_MAX / 2;
+    lock_release(&pool->lock);
+
+    if (low && __atomic_exchange_n(&zeroer_asleep, false, __ATOMIC_ACQ_REL))
+        sema_up(&zeroed_wanted);
+    if (e == NULL) return NULL;
+
+    /* Clear the list element that linked it. */
+    memset(e, 0, sizeof *e);
+    return e;
+}
+
+/* Gives all of POOL's zeroed pages back to the buddy allocator.
+   POOL's lock must be held. */
+static void release_zeroed_pages(struct pool* pool) {
+    while (!list_empty(&pool->zeroed))
+    {
+        size_t page_idx = page_index(pool, list_pop_front(&pool->zeroed));
+
+        bitmap_reset(pool->used_map, page_idx);
+        free_pages(pool, page_idx, 1);
+    }
+    pool->zeroed_cnt = 0;
+}
+
+/* Zeroes a page for POOL if it is short of zeroed pages.
+   Returns true if it did. */
+static bool refill_zeroed(struct pool* pool) {
+    size_t page_idx;
+    void* page;
+
+    lock_acquire(&pool->lock);
+    page_idx = pool->zeroed_cnt < ZEROED_MAX ? alloc_pages(pool, 1)
+                                             : BITMAP_ERROR;
+    lock_release(&pool->lock);
+    if (page_idx == BITMAP_ERROR) return false;
+
+    page = pool->base + PGSIZE * page_idx;
+    memset(page, 0, PGSIZE);
+
+    lock_acquire(&pool->lock);
+    list_push_back(&pool->zeroed, page);
+    pool->zeroed_cnt++;
+    lock_release(&pool->lock);
+    return true;
+}
+
+/* Thread that zeroes pages ahead of time.  It runs at the lowest
+   priority, so it only uses time that would otherwise be idle. */
+static void page_zeroer(void* aux UNUSED) {
+    if (thread_mlfqs) thread_set_nice(20);
+
+    for (;;)
+    {
+        bool kernel = refill_zeroed(&kernel_pool);
+        bool user = refill_zeroed(&user_pool);
+
+        if (kernel || user) continue;
+
+        /* Announce that we are going to sleep, then look once more,
+           in case a page was taken before the announcement.  If we
+           find work after all but someone has already cleared the
+           flag, they upped the semaphore, so take that up. */
+        __atomic_store_n(&zeroer_asleep, true, __ATOMIC_RELEASE);
+        kernel = refill_zeroed(&kernel_pool);
+        user = refill_zeroed(&user_pool);
+        if ((!kernel && !user) ||
+            !__atomic_exchange_n(&zeroer_asleep, false, __ATOMIC_ACQ_REL))
+            sema_down(&zeroed_wanted);
+    }
+}
+
+/* Starts zeroing pages in the background.  Must be called after
+   the scheduler is started. */
+void palloc_start_zeroing(void) {
+    thread_create("pagezero", PRI_MIN, page_zeroer, NULL);
+}
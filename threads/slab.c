@@ -0,0 +1,224 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Slab allocator.
+
+   malloc() rounds every request up to one of its size classes,
+   which can waste nearly half of a small block and an eighth of
+   a large one, and mixes objects of unrelated types.  An object
+   cache instead hands out objects of exactly one size, packed
+   into page-sized "slabs".  Each slab starts with a header that
+   records which of its objects are free, and sits on one of
+   three lists in its cache: partial (some objects free), full
+   (none free) or empty (all free).  Allocation takes from a
+   partial slab if there is one, so that objects stay packed into
+   as few pages as possible.
+
+   If the cache has a constructor, it runs once on every object
+   when its slab is created, not on every allocation, and freed
+   objects must be returned in their constructed state.  Free
+   objects are therefore linked through an index array in the
+   slab header, not through the objects themselves.
+
+   A cache keeps at most one empty slab; any others are returned
+   to the page allocator as they become empty. */
+
+/* Object cache. */
+struct kmem_cache {
+    const char* name;      /* For statistics. */
+    size_t size;           /* Object size, a multiple of the alignment. */
+    size_t align;          /* Object alignment. */
+    kmem_ctor_func* ctor;  /* Constructor, or null. */
+    size_t objs_per_slab;  /* Number of objects in a slab. */
+    size_t objs_ofs;       /* Offset of first object in a slab. */
+    struct list partial;   /* Slabs with some free objects. */
+    struct list full;      /* Slabs with no free objects. */
+    struct list empty;     /* Slabs with only free objects. */
+    size_t slab_cnt;       /* Number of slabs on all three lists. */
+    size_t in_use;         /* Number of allocated objects. */
+    struct lock lock;      /* Protects all of the above lists. */
+    struct list_elem elem; /* Element in cache_list. */
+};
+
+/* Marks the end of a slab's free object chain. */
+#define SLAB_NONE UINT16_MAX
+
+/* Slab header, at the start of each slab's page. */
+struct slab {
+    struct list_elem elem;    /* Element in one of the cache's lists. */
+    struct kmem_cache* cache; /* Owning cache. */
+    size_t in_use;            /* Number of allocated objects. */
+    uint16_t free;            /* Index of first free object. */
+    uint16_t next[];          /* Next free object after each object. */
+};
+
+/* All object caches. */
+static struct list cache_list;
+static struct lock cache_list_lock;
+
+/* Initializes the slab allocator. */
+void kmem_init(void) {
+    list_init(&cache_list);
+    lock_init(&cache_list_lock);
+}
+
+/* Returns the offset of the first object in a slab of OBJ_CNT
+   objects aligned to ALIGN. */
+static size_t objs_offset(size_t obj_cnt, size_t align) {
+    return ROUND_UP(sizeof(struct slab) + obj_cnt * sizeof(uint16_t), align);
+}
+
+/* Creates and returns a cache of objects of SIZE bytes, each
+   aligned to ALIGN bytes, a power of 2, or to a pointer if ALIGN
+   is 0.  If CTOR is nonnull, it initializes each new object.
+   NAME identifies the cache in statistics and must remain valid.
+   Returns a null pointer if memory is not available. */
+struct kmem_cache* kmem_cache_create(const char* name,
+                                     size_t size,
+                                     size_t align,
+                                     kmem_ctor_func* ctor) {
+    struct kmem_cache* cache;
+    size_t n;
+
+    if (align == 0) align = sizeof(void*);
+    ASSERT((align & (align - 1)) == 0);
+    size = ROUND_UP(size, align);
+
+    /* Fit as many objects into a page as we can. */
+    n = (PGSIZE - sizeof(struct slab)) / (size + sizeof(uint16_t));
+    while (n > 0 && objs_offset(n, align) + n * size > PGSIZE) n--;
+    ASSERT(n > 0 && n < SLAB_NONE);
+
+    cache = malloc(sizeof *cache);
+    if (cache == NULL) return NULL;
+
+    cache->name = name;
+    cache->size = size;
+    cache->align = align;
+    cache->ctor = ctor;
+    cache->objs_per_slab = n;
+    cache->objs_ofs = objs_offset(n, align);
+    list_init(&cache->partial);
+    list_init(&cache->full);
+    list_init(&cache->empty);
+    cache->slab_cnt = 0;
+    cache->in_use = 0;
+    lock_init(&cache->lock);
+
+    lock_acquire(&cache_list_lock);
+    list_push_back(&cache_list, &cache->elem);
+    lock_release(&cache_list_lock);
+    return cache;
+}
+
+/* Returns object IDX in SLAB. */
+static void* slab_obj(struct slab* slab, size_t idx) {
+    struct kmem_cache* cache = slab->cache;
+    return (uint8_t*)slab + cache->objs_ofs + idx * cache->size;
+}
+
+/* Allocates a new slab for CACHE and constructs its objects.
+   Returns a null pointer if memory is not available. */
+static struct slab* slab_create(struct kmem_cache* cache) {
+    struct slab* slab = palloc_get_page(0);
+    size_t i;
+
+    if (slab == NULL) return NULL;
+
+    slab->cache = cache;
+    slab->in_use = 0;
+    slab->free = 0;
+    for (i = 0; i < cache->objs_per_slab; i++)
+    {
+        slab->next[i] = i + 1 < cache->objs_per_slab ? i + 1 : SLAB_NONE;
+        if (cache->ctor != NULL) cache->ctor(slab_obj(slab, i));
+    }
+    cache->slab_cnt++;
+    return slab;
+}
+
+/* Obtains and returns an object from CACHE.
+   Returns a null pointer if memory is not available. */
+void* kmem_cache_alloc(struct kmem_cache* cache) {
+    struct slab* slab;
+    void* obj;
+
+    lock_acquire(&cache->lock);
+    if (!list_empty(&cache->partial))
+        slab = list_entry(list_pop_front(&cache->partial), struct slab, elem);
+    else if (!list_empty(&cache->empty))
+        slab = list_entry(list_pop_front(&cache->empty), struct slab, elem);
+    else
+    {
+        slab = slab_create(cache);
+        if (slab == NULL)
+        {
+            lock_release(&cache->lock);
+            return NULL;
+        }
+    }
+
+    obj = slab_obj(slab, slab->free);
+    slab->free = slab->next[slab->free];
+    slab->in_use++;
+    cache->in_use++;
+    list_push_front(slab->free != SLAB_NONE ? &cache->partial : &cache->full,
+                    &slab->elem);
+    lock_release(&cache->lock);
+    return obj;
+}
+
+/* Returns OBJ, which was allocated from CACHE, to CACHE. */
+void kmem_cache_free(struct kmem_cache* cache, void* obj) {
+    struct slab* slab;
+    size_t idx;
+
+    if (obj == NULL) return;
+
+    slab = pg_round_down(obj);
+    ASSERT(slab->cache == cache);
+    idx = ((uint8_t*)obj - (uint8_t*)slab - cache->objs_ofs) / cache->size;
+    ASSERT(slab_obj(slab, idx) == obj);
+
+    lock_acquire(&cache->lock);
+    ASSERT(slab->in_use > 0);
+    slab->next[idx] = slab->free;
+    slab->free = idx;
+    slab->in_use--;
+    cache->in_use--;
+
+    list_remove(&slab->elem);
+    if (slab->in_use > 0)
+        list_push_front(&cache->partial, &slab->elem);
+    else if (list_empty(&cache->empty))
+        list_push_front(&cache->empty, &slab->elem);
+    else
+    {
+        cache->slab_cnt--;
+        palloc_free_page(slab);
+    }
+    lock_release(&cache->lock);
+}
+
+/* Prints object cache statistics. */
+void kmem_cache_print_stats(void) {
+    struct list_elem* e;
+
+    lock_acquire(&cache_list_lock);
+    for (e = list_begin(&cache_list); e != list_end(&cache_list);
+         e = list_next(e))
+    {
+        struct kmem_cache* cache = list_entry(e, struct kmem_cache, elem);
+        printf("Cache %s: %zu-byte objects, %zu in use, %zu slabs\n",
+               cache->name, cache->size, cache->in_use, cache->slab_cnt);
+    }
+    lock_release(&cache_list_lock);
+}
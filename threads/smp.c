@@ -0,0 +1,525 @@
+#include "threads/smp.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "intrinsic.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Symmetric multiprocessing.
+
+   At boot, only the bootstrap processor (BSP) runs.  smp_init()
+   finds the other CPUs, the application processors (APs), in the
+   ACPI MADT, routes device interrupts through the IOAPIC instead
+   of the 8259A PICs, and starts each AP with the INIT-SIPI-SIPI
+   sequence.  An AP wakes up in real mode at the trampoline in
+   ap-entry.S, which takes it to long mode and into ap_main().
+
+   See [IA32-v3a] 10.4 "Local APIC", 8.4 "Multiple-Processor (MP)
+   Initialization", and chapter 5 of the ACPI specification. */
+
+#define MSR_GS_BASE 0xc0000101 /* GS base; points to struct cpu. */
+
+/* All CPUs.  cpus[0] is the BSP. */
+struct cpu cpus[CPU_MAX];
+int cpu_cnt = 1;
+
+/* ACPI Root System Description Pointer. */
+struct rsdp {
+    char signature[8]; /* "RSD PTR ". */
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_addr; /* Physical address of the RSDT. */
+} __attribute__((packed));
+
+/* Header common to all ACPI system description tables. */
+struct sdt_header {
+    char signature[4];
+    uint32_t length; /* Including this header. */
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+/* Multiple APIC Description Table. */
+struct madt {
+    struct sdt_header h; /* Signature "APIC". */
+    uint32_t lapic_addr; /* Physical address of the local APICs. */
+    uint32_t flags;
+    uint8_t entries[];   /* Variable-length entries, see below. */
+} __attribute__((packed));
+
+/* MADT entry types. */
+#define MADT_LAPIC 0    /* A processor and its local APIC. */
+#define MADT_IOAPIC 1   /* An IOAPIC. */
+#define MADT_OVERRIDE 2 /* ISA IRQ to global system interrupt. */
+
+/* Local APIC registers, as byte offsets. */
+#define LAPIC_ID 0x020         /* ID, in bits 24...31. */
+#define LAPIC_TPR 0x080        /* Task priority. */
+#define LAPIC_EOI 0x0b0        /* End of interrupt. */
+#define LAPIC_SVR 0x0f0        /* Spurious interrupt vector. */
+#define LAPIC_ICR_LO 0x300     /* Interrupt command, low half. */
+#define LAPIC_ICR_HI 0x310     /* Interrupt command, high half. */
+#define LAPIC_LVT_TIMER 0x320  /* Timer local vector table entry. */
+#define LAPIC_TIMER_INIT 0x380 /* Timer initial count. */
+#define LAPIC_TIMER_CUR 0x390  /* Timer current count. */
+#define LAPIC_TIMER_DIV 0x3e0  /* Timer divide configuration. */
+
+#define SVR_ENABLE 0x100           /* APIC software enable. */
+#define ICR_INIT 0x4500            /* INIT, level assert. */
+#define ICR_STARTUP 0x4600         /* Start-up IPI, level assert. */
+#define ICR_PENDING (1 << 12)      /* Delivery status: send pending. */
+#define LVT_MASKED (1 << 16)       /* Interrupt masked. */
+#define LVT_PERIODIC (1 << 17)     /* Timer mode: periodic. */
+#define TIMER_DIV_16 0x3           /* Divide the bus clock by 16. */
+#define LAPIC_CALIBRATE_TICKS 5    /* PIT ticks to calibrate over. */
+
+/* IOAPIC registers, selected through IOREGSEL, accessed through
+   IOWIN. */
+#define IOAPIC_VER 0x01     /* Version; bits 16...23 = max entry. */
+#define IOAPIC_REDTBL 0x10  /* Redirection entries, 2 regs each. */
+#define REDIR_ACTIVE_LOW (1 << 13)
+#define REDIR_LEVEL (1 << 15)
+
+/* AP trampoline, in ap-entry.S.  It is copied to AP_TRAMPOLINE,
+   which must be page-aligned and below 1 MB because the start-up
+   IPI can only name the page it starts at. */
+#define AP_TRAMPOLINE 0x8000
+extern const char ap_trampoline[], ap_trampoline_end[];
+
+/* Parameters for the AP being started, read by ap-entry.S and
+   ap_main().  APs are started one at a time. */
+uint64_t ap_boot_cr3;        /* Physical address of base_pml4. */
+uint64_t ap_boot_stack;      /* Initial stack pointer. */
+static struct cpu* ap_boot_cpu;
+
+static volatile uint32_t* lapic;  /* Local APIC registers. */
+static volatile uint32_t* ioapic; /* IOAPIC registers. */
+static uint32_t ioapic_gsi_base;  /* First GSI the IOAPIC handles. */
+static uint32_t lapic_timer_count; /* LAPIC timer counts per tick. */
+
+/* TLB shootdown state; see smp_flush_tlb(). */
+static struct lock tlb_flush_lock;
+static volatile int tlb_flush_pending; /* CPUs yet to flush. */
+
+/* ISA IRQ to GSI mapping and redirection flags, from the MADT's
+   interrupt source overrides. */
+static uint32_t irq_gsi[16];
+static uint32_t irq_flags[16];
+static bool irq_overridden[16];
+
+static struct madt* find_madt(void);
+static int parse_madt(struct madt*);
+static void* map_phys(uint64_t pa, size_t size);
+static void lapic_init(void);
+static void lapic_eoi(int vec);
+static void lapic_ipi(uint8_t apic_id, uint32_t icr);
+static void lapic_calibrate(void);
+static void lapic_timer_start(void);
+static void tlb_flush_interrupt(struct intr_frame*);
+static void ioapic_init(void);
+static bool start_ap(struct cpu*);
+static intr_handler_func lapic_timer_interrupt;
+static intr_handler_func resched_interrupt;
+static intr_handler_func spurious_interrupt;
+void ap_main(void) NO_RETURN;
+
+/* Makes the BSP's per-CPU data reachable through its GS base.
+   Must be called before anything calls cpu_current(), which
+   includes intr_context() and so printf(). */
+void smp_early_init(void) {
+    struct cpu* bsp = &cpus[0];
+
+    bsp->self = bsp;
+    bsp->id = 0;
+    bsp->started = true;
+    write_msr(MSR_GS_BASE, (uint64_t)bsp);
+}
+
+/* Finds the other CPUs and starts them.  Does nothing if there
+   are none, leaving the uniprocessor setup alone. */
+void smp_init(void) {
+    struct madt* madt;
+    int ap_cnt;
+
+#ifdef USERPROG
+    /* syscall_entry saves user registers in global scratch words
+       and finds the kernel stack in the single TSS, so user
+       programs can only run on one CPU for now. */
+    return;
+#endif
+
+    madt = find_madt();
+    if (madt == NULL) return;
+    ap_cnt = parse_madt(madt);
+    if (ap_cnt == 0 || ioapic == NULL) return;
+
+    /* From now on, interrupts come through the APICs. */
+    lapic_init();
+    cpus[0].apic_id = lapic[LAPIC_ID / 4] >> 24;
+    ioapic_init();
+    lapic_calibrate();
+
+    intr_register_ext(VEC_LAPIC_TIMER, lapic_timer_interrupt, "LAPIC timer");
+    intr_register_ext(VEC_RESCHED, resched_interrupt, "Reschedule IPI");
+    intr_register_ext(VEC_TLB_FLUSH, tlb_flush_interrupt, "TLB flush IPI");
+    lock_init(&tlb_flush_lock);
+    intr_register_int(VEC_SPURIOUS, 0, INTR_OFF, spurious_interrupt,
+                      "LAPIC spurious");
+
+    /* Get ready for the APs. */
+    memcpy(ptov(AP_TRAMPOLINE), ap_trampoline,
+           ap_trampoline_end - ap_trampoline);
+    ap_boot_cr3 = vtop(base_pml4);
+
+    for (int i = 1; i <= ap_cnt; i++)
+        if (!start_ap(&cpus[i]))
+        {
+            printf("cpu%d: APIC ID %d did not start\n", i, cpus[i].apic_id);
+            break;
+        }
+    printf("SMP: %d CPUs online.\n", cpu_cnt);
+}
+
+/* Asks CPU C to look at its run queue. */
+void smp_send_resched(struct cpu* c) {
+    ASSERT(lapic != NULL);
+
+    lapic_ipi(c->apic_id, VEC_RESCHED);
+}
+
+/* Flushes the TLB of every CPU, and waits until all of them have
+   done so.  Must be called with interrupts on, so that the other
+   CPUs can run their interrupt handlers while we wait. */
+void smp_flush_tlb(void) {
+    enum intr_level old_level;
+    int i;
+
+    if (cpu_cnt == 1)
+    {
+        tlb_flush_all();
+        return;
+    }
+
+    ASSERT(intr_get_level() == INTR_ON);
+    lock_acquire(&tlb_flush_lock);
+    old_level = intr_disable();
+    tlb_flush_all();
+    tlb_flush_pending = cpu_cnt - 1;
+    for (i = 0; i < cpu_cnt; i++)
+        if (&cpus[i] != cpu_current())
+            lapic_ipi(cpus[i].apic_id, VEC_TLB_FLUSH);
+    intr_set_level(old_level);
+
+    while (tlb_flush_pending > 0) asm volatile("pause");
+    lock_release(&tlb_flush_lock);
+}
+
+/* Brings up AP C and waits for it to enter its idle loop.
+   Returns false if it did not show up within 100 ms. */
+static bool start_ap(struct cpu* c) {
+    enum intr_level old_level;
+    struct thread* idle;
+    int64_t start;
+
+    idle = thread_prepare_ap(c);
+    old_level = intr_disable();
+    cpu_cnt++;
+    intr_set_level(old_level);
+
+    ap_boot_cpu = c;
+    ap_boot_stack = (uint64_t)idle + PGSIZE;
+
+    /* INIT, then two start-up IPIs pointing at the trampoline. */
+    lapic_ipi(c->apic_id, ICR_INIT);
+    timer_msleep(10);
+    for (int i = 0; i < 2 && !c->started; i++)
+    {
+        lapic_ipi(c->apic_id, ICR_STARTUP | (AP_TRAMPOLINE >> 12));
+        timer_usleep(200);
+    }
+
+    start = timer_ticks();
+    while (!c->started && timer_elapsed(start) < TIMER_FREQ / 10)
+        barrier();
+    if (c->started) return true;
+
+    old_level = intr_disable();
+    cpu_cnt--;
+    intr_set_level(old_level);
+    return false;
+}
+
+/* C entry point of an AP, called by ap-entry.S on the stack of
+   the AP's idle thread, with interrupts off. */
+void ap_main(void) {
+    struct cpu* c = ap_boot_cpu;
+
+    write_msr(MSR_GS_BASE, (uint64_t)c);
+    intr_ap_init();
+    lapic_init();
+    lapic_timer_start();
+    thread_start_ap();
+}
+
+/* Returns true if the LEN bytes at P sum to zero mod 256, as
+   every ACPI table's bytes must. */
+static bool checksum_ok(const void* p, size_t len) {
+    const uint8_t* b = p;
+    uint8_t sum = 0;
+
+    while (len-- > 0) sum += *b++;
+    return sum == 0;
+}
+
+/* Looks for the RSDP in the LEN bytes at physical address PA. */
+static struct rsdp* scan_rsdp(uint64_t pa, size_t len) {
+    for (uint64_t p = pa; p < pa + len; p += 16)
+    {
+        struct rsdp* r = ptov(p);
+        if (!memcmp(r->signature, "RSD PTR ", 8) &&
+            checksum_ok(r, sizeof *r))
+            return r;
+    }
+    return NULL;
+}
+
+/* Returns the MADT, or a null pointer if the firmware has none. */
+static struct madt* find_madt(void) {
+    struct rsdp* rsdp;
+    struct sdt_header* rsdt;
+    uint32_t* entries;
+    size_t cnt;
+
+    /* The RSDP is in the first KB of the EBDA, whose segment is at
+       0x40e, or in the BIOS ROM between 0xe0000 and 0xfffff. */
+    rsdp = scan_rsdp((uint64_t)*(uint16_t*)ptov(0x40e) << 4, 1024);
+    if (rsdp == NULL) rsdp = scan_rsdp(0xe0000, 0x20000);
+    if (rsdp == NULL) return NULL;
+
+    rsdt = map_phys(rsdp->rsdt_addr, sizeof *rsdt);
+    rsdt = map_phys(rsdp->rsdt_addr, rsdt->length);
+    if (!checksum_ok(rsdt, rsdt->length)) return NULL;
+
+    entries = (uint32_t*)(rsdt + 1);
+    cnt = (rsdt->length - sizeof *rsdt) / sizeof *entries;
+    for (size_t i = 0; i < cnt; i++)
+    {
+        struct sdt_header* h = map_phys(entries[i], sizeof *h);
+        if (!memcmp(h->signature, "APIC", 4))
+        {
+            h = map_phys(entries[i], h->length);
+            return checksum_ok(h, h->length) ? (struct madt*)h : NULL;
+        }
+    }
+    return NULL;
+}
+
+/* Records the CPUs, IOAPIC and IRQ overrides that MADT
+   describes.  Returns the number of APs found. */
+static int parse_madt(struct madt* madt) {
+    uint8_t* p = madt->entries;
+    uint8_t* end = (uint8_t*)madt + madt->h.length;
+    uint8_t bsp_apic_id;
+    int ap_cnt = 0;
+
+    lapic = map_phys(madt->lapic_addr, PGSIZE);
+    bsp_apic_id = lapic[LAPIC_ID / 4] >> 24;
+
+    for (int irq = 0; irq < 16; irq++) irq_gsi[irq] = irq;
+
+    for (; p < end && p[1] != 0; p += p[1])
+        switch (p[0])
+        {
+            case MADT_LAPIC:
+                /* ACPI processor ID, APIC ID, flags (bit 0: enabled). */
+                if ((*(uint32_t*)(p + 4) & 1) && p[3] != bsp_apic_id &&
+                    ap_cnt < CPU_MAX - 1)
+                {
+                    struct cpu* c = &cpus[++ap_cnt];
+                    c->self = c;
+                    c->id = ap_cnt;
+                    c->apic_id = p[3];
+                }
+                break;
+
+            case MADT_IOAPIC:
+                /* ID, reserved, address, GSI base.  We only use the
+                   first IOAPIC, which handles the ISA IRQs. */
+                if (ioapic == NULL)
+                {
+                    ioapic = map_phys(*(uint32_t*)(p + 4), PGSIZE);
+                    ioapic_gsi_base = *(uint32_t*)(p + 8);
+                }
+                break;
+
+            case MADT_OVERRIDE:
+                /* Bus, IRQ, GSI, flags. */
+                if (p[3] < 16)
+                {
+                    irq_gsi[p[3]] = *(uint32_t*)(p + 4);
+                    irq_flags[p[3]] = *(uint16_t*)(p + 8);
+                    irq_overridden[p[3]] = true;
+                }
+                break;
+        }
+    return ap_cnt;
+}
+
+/* Maps the SIZE bytes at physical address PA, which may lie
+   beyond the RAM that paging_init() mapped, into base_pml4 at
+   ptov(PA), with caching disabled, and returns ptov(PA).  Pages
+   that are already mapped are left alone. */
+static void* map_phys(uint64_t pa, size_t size) {
+    for (uint64_t p = pa & ~PGMASK; p < pa + size; p += PGSIZE)
+    {
+        uint64_t* pte = pml4e_walk(base_pml4, (uint64_t)ptov(p), 1);
+
+        /* No page table means that a 2 MB page of the direct map
+           already covers it. */
+        if (pte != NULL && !(*pte & PTE_P))
+        {
+            *pte = p | PTE_P | PTE_W | PTE_PCD | PTE_PWT;
+            asm volatile("invlpg (%0)" : : "r"(ptov(p)) : "memory");
+        }
+    }
+    return ptov(pa);
+}
+
+/* Enables the calling CPU's local APIC and lets it accept
+   interrupts of every priority. */
+static void lapic_init(void) {
+    lapic[LAPIC_SVR / 4] = SVR_ENABLE | VEC_SPURIOUS;
+    lapic[LAPIC_TPR / 4] = 0;
+    lapic[LAPIC_EOI / 4] = 0;
+}
+
+/* Acknowledges an interrupt on the calling CPU's local APIC. */
+static void lapic_eoi(int vec UNUSED) { lapic[LAPIC_EOI / 4] = 0; }
+
+/* Sends an interprocessor interrupt described by ICR to the CPU
+   whose local APIC has APIC_ID. */
+static void lapic_ipi(uint8_t apic_id, uint32_t icr) {
+    enum intr_level old_level = intr_disable();
+
+    while (lapic[LAPIC_ICR_LO / 4] & ICR_PENDING) asm volatile("pause");
+    lapic[LAPIC_ICR_HI / 4] = (uint32_t)apic_id << 24;
+    lapic[LAPIC_ICR_LO / 4] = icr;
+
+    intr_set_level(old_level);
+}
+
+/* Measures how far the local APIC timer counts down in one PIT
+   tick, so that the APs can tick at TIMER_FREQ.  All local APIC
+   timers run off the same bus clock, so measuring on the BSP
+   is good enough. */
+static void lapic_calibrate(void) {
+    uint32_t left;
+    int64_t start;
+
+    lapic[LAPIC_TIMER_DIV / 4] = TIMER_DIV_16;
+    lapic[LAPIC_LVT_TIMER / 4] = LVT_MASKED | VEC_LAPIC_TIMER;
+
+    /* Start counting on a tick boundary. */
+    start = timer_ticks();
+    while (timer_ticks() == start) barrier();
+    lapic[LAPIC_TIMER_INIT / 4] = UINT32_MAX;
+
+    start = timer_ticks();
+    while (timer_elapsed(start) < LAPIC_CALIBRATE_TICKS) barrier();
+    left = lapic[LAPIC_TIMER_CUR / 4];
+    lapic[LAPIC_TIMER_INIT / 4] = 0;
+
+    lapic_timer_count = (UINT32_MAX - left) / LAPIC_CALIBRATE_TICKS;
+}
+
+/* Starts the calling CPU's local APIC timer ticking at
+   TIMER_FREQ. */
+static void lapic_timer_start(void) {
+    lapic[LAPIC_TIMER_DIV / 4] = TIMER_DIV_16;
+    lapic[LAPIC_LVT_TIMER / 4] = LVT_PERIODIC | VEC_LAPIC_TIMER;
+    lapic[LAPIC_TIMER_INIT / 4] = lapic_timer_count;
+}
+
+/* Writes VAL to IOAPIC register REG. */
+static void ioapic_write(uint32_t reg, uint32_t val) {
+    ioapic[0] = reg;
+    ioapic[4] = val;
+}
+
+/* Reads IOAPIC register REG. */
+static uint32_t ioapic_read(uint32_t reg) {
+    ioapic[0] = reg;
+    return ioapic[4];
+}
+
+/* Routes ISA IRQ N to vector 0x20 + N on the BSP, the same
+   vectors the PICs used, then retires the PICs. */
+static void ioapic_init(void) {
+    enum intr_level old_level = intr_disable();
+    uint32_t max_entry = (ioapic_read(IOAPIC_VER) >> 16) & 0xff;
+
+    for (int irq = 0; irq < 16; irq++)
+    {
+        uint32_t gsi = irq_gsi[irq] - ioapic_gsi_base;
+        uint32_t lo = 0x20 + irq;
+        bool taken = false;
+
+        /* An IRQ that another IRQ was redirected onto is not
+           connected; on QEMU, the PIT's IRQ 0 takes GSI 2, which
+           would otherwise be the cascade. */
+        for (int other = 0; other < 16; other++)
+            if (other != irq && irq_overridden[other] &&
+                irq_gsi[other] == irq_gsi[irq])
+                taken = true;
+        if (taken && !irq_overridden[irq]) continue;
+        if (irq_gsi[irq] < ioapic_gsi_base || gsi > max_entry) continue;
+
+        /* MPS INTI flags: polarity in bits 0...1 and trigger mode in
+           bits 2...3, where 3 means active low and level. */
+        if ((irq_flags[irq] & 3) == 3) lo |= REDIR_ACTIVE_LOW;
+        if (((irq_flags[irq] >> 2) & 3) == 3) lo |= REDIR_LEVEL;
+
+        ioapic_write(IOAPIC_REDTBL + 2 * gsi + 1,
+                     (uint32_t)cpus[0].apic_id << 24);
+        ioapic_write(IOAPIC_REDTBL + 2 * gsi, lo);
+    }
+    intr_use_apic(lapic_eoi);
+
+    intr_set_level(old_level);
+}
+
+/* Local APIC timer interrupt on an AP.  The BSP keeps time with
+   the PIT; the APs only need to preempt their threads. */
+static void lapic_timer_interrupt(struct intr_frame* args UNUSED) {
+    thread_tick();
+}
+
+/* Another CPU queued a thread for us.  An idle CPU picks it up as
+   soon as it returns to its idle loop; a busy one yields to let
+   the scheduler decide. */
+static void resched_interrupt(struct intr_frame* args UNUSED) {
+    if (thread_current() != cpu_current()->idle_thread)
+        intr_yield_on_return();
+}
+
+/* Another CPU changed kernel mappings.  Several CPUs may answer
+   at once, so the count is decremented atomically. */
+static void tlb_flush_interrupt(struct intr_frame* args UNUSED) {
+    tlb_flush_all();
+    __atomic_fetch_sub(&tlb_flush_pending, 1, __ATOMIC_RELEASE);
+}
+
+/* Spurious local APIC interrupts must not be acknowledged. */
+static void spurious_interrupt(struct intr_frame* args UNUSED) {}
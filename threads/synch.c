@@ -27,9 +27,11 @@
    */
 
 #include "threads/synch.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include "list.h"
+#include "intrinsic.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
@@ -45,6 +47,7 @@
 void sema_init(struct semaphore* sema, unsigned value) {
     ASSERT(sema != NULL);
 
+    spin_init(&sema->lock);
     sema->value = value;
     list_init(&sema->waiters);
 }
@@ -64,15 +67,15 @@ void sema_down(struct semaphore* sema) {
     ASSERT(!intr_context());
 
     old_level = intr_disable();
-    if (sema->value == 0)
+    spin_lock(&sema->lock);
+    while (sema->value == 0)
     {
-        thread_current()->waiting_sema = sema;
-        list_insert_ordered(&sema->waiters, &thread_current()->elem,
-                            high_priority_first, NULL);
-        thread_block();
+        list_push_back(&sema->waiters, &thread_current()->elem);
+        thread_block_locked(&sema->lock);
+        spin_lock(&sema->lock);
     }
     sema->value--;
-    thread_current()->waiting_sema = NULL;
+    spin_unlock(&sema->lock);
     intr_set_level(old_level);
 }
 
@@ -88,6 +91,7 @@ bool sema_try_down(struct semaphore* sema) {
     ASSERT(sema != NULL);
 
     old_level = intr_disable();
+    spin_lock(&sema->lock);
     if (sema->value > 0)
     {
         sema->value--;
@@ -95,53 +99,48 @@ bool sema_try_down(struct semaphore* sema) {
     }
     else
         success = false;
+    spin_unlock(&sema->lock);
     intr_set_level(old_level);
 
     return success;
 }
 
+/* Removes and returns the highest-priority thread waiting for
+   SEMA, the one that has waited longest among equals.  Donation
+   may raise a waiter's priority at any time, so the waiters are
+   not kept sorted.  SEMA's lock must be held. */
+static struct thread* sema_pop_waiter(struct semaphore* sema) {
+    struct list_elem* e =
+        list_min(&sema->waiters, high_priority_first, NULL);
+
+    list_remove(e);
+    return list_entry(e, struct thread, elem);
+}
+
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
    and wakes up one thread of those waiting for SEMA, if any.
 
-   This function may be called from an interrupt handler. */
+   This function may be called from an interrupt handler.  The
+   caller must not hold any spinlock, because waking a thread
+   may yield. */
 void sema_up(struct semaphore* sema) {
     enum intr_level old_level;
+    struct thread* t = NULL;
 
     ASSERT(sema != NULL);
 
     old_level = intr_disable();
-
+    spin_lock(&sema->lock);
     sema->value++;  // 자원은 항상 반납
+    if (!list_empty(&sema->waiters)) t = sema_pop_waiter(sema);
+    spin_unlock(&sema->lock);
 
-    if (!list_empty(&sema->waiters))
-    {
-        // thread_unblock 내부에서 필요 시 스케줄링 알아서 된다.
-        thread_unblock(
-            list_entry(list_pop_front(&sema->waiters), struct thread, elem));
-    }
-
+    /* SEMA may be gone as soon as its lock is released, but T
+       cannot run again until we wake it. */
+    if (t != NULL) thread_unblock(t);
     intr_set_level(old_level);
 }
 
-void reorder_sema_waiters(struct semaphore* sema) {
-    if (list_empty(&sema->waiters)) return;
-
-    struct list temp;
-    list_init(&temp);
-
-    while (!list_empty(&sema->waiters))
-    {
-        struct list_elem* e = list_pop_front(&sema->waiters);
-        list_insert_ordered(&temp, e, high_priority_first, NULL);
-    }
-
-    while (!list_empty(&temp))
-    {
-        struct list_elem* e = list_pop_front(&temp);
-        list_push_back(&sema->waiters, e);
-    }
-}
-
 static void sema_test_helper(void* sema_);
 
 /* Self-test for semaphores that makes control "ping-pong"
@@ -195,6 +194,281 @@ void lock_init(struct lock* lock) {
 
     lock->holder = NULL;
     sema_init(&lock->semaphore, 1);
+    lock->max_priority = -1;
+    lock->heap_child = lock->heap_prev = lock->heap_next = NULL;
+#ifdef LOCKSTAT
+    memset(&lock->stat, 0, sizeof lock->stat);
+    lock->acquire_time = 0;
+#endif
+}
+
+#ifdef LOCKSTAT
+/* Maximum number of named locks. */
+#define NAMED_LOCK_MAX 64
+
+/* Named locks, and statistics for all the unnamed ones. */
+static struct lock* named_locks[NAMED_LOCK_MAX];
+static size_t named_lock_cnt;
+static struct lock_stat unnamed_stat = {.name = "(unnamed)"};
+
+/* Protects the registry and all the statistics. */
+static struct spinlock lockstat_lock;
+
+/* Names LOCK, so that lock_print_stats() reports it on its own.
+   LOCK must never be freed afterward. */
+void lock_set_name(struct lock* lock, const char* name) {
+    enum intr_level old_level;
+
+    ASSERT(lock != NULL);
+    ASSERT(name != NULL);
+
+    old_level = intr_disable();
+    spin_lock(&lockstat_lock);
+    if (lock->stat.name == NULL)
+    {
+        ASSERT(named_lock_cnt < NAMED_LOCK_MAX);
+        named_locks[named_lock_cnt++] = lock;
+    }
+    lock->stat.name = name;
+    spin_unlock(&lockstat_lock);
+    intr_set_level(old_level);
+}
+
+/* Returns the statistics that LOCK's events are counted in. */
+static struct lock_stat* lock_stat_of(struct lock* lock) {
+    return lock->stat.name != NULL ? &lock->stat : &unnamed_stat;
+}
+
+/* Records that the current thread acquired LOCK, having started
+   to try at time START.  Must be called with interrupts off. */
+static void lockstat_acquired(struct lock* lock,
+                              uint64_t start,
+                              bool contended) {
+    struct lock_stat* s = lock_stat_of(lock);
+    uint64_t now = rdtsc();
+
+    spin_lock(&lockstat_lock);
+    s->acquired++;
+    if (contended)
+    {
+        uint64_t wait = now - start;
+
+        s->contended++;
+        s->wait_total += wait;
+        if (wait > s->wait_max) s->wait_max = wait;
+    }
+    spin_unlock(&lockstat_lock);
+    lock->acquire_time = now;
+}
+
+/* Records that the current thread is releasing LOCK.  Must be
+   called with interrupts off. */
+static void lockstat_released(struct lock* lock) {
+    uint64_t held = rdtsc() - lock->acquire_time;
+
+    spin_lock(&lockstat_lock);
+    lock_stat_of(lock)->hold_total += held;
+    spin_unlock(&lockstat_lock);
+}
+
+static void print_lock_stat(const struct lock_stat* s) {
+    printf("%-16s %10" PRIu64 " %10" PRIu64 " %14" PRIu64 " %12" PRIu64
+           " %14" PRIu64 "\n",
+           s->name, s->acquired, s->contended, s->wait_total, s->wait_max,
+           s->hold_total);
+}
+
+/* Prints lock statistics, named locks with the most total wait
+   time first. */
+void lock_print_stats(void) {
+    struct lock* sorted[NAMED_LOCK_MAX];
+    size_t cnt = named_lock_cnt;
+    size_t i, j;
+
+    /* Insertion sort; there are only a few named locks. */
+    for (i = 0; i < cnt; i++)
+    {
+        struct lock* l = named_locks[i];
+        for (j = i; j > 0 && sorted[j - 1]->stat.wait_total <
+                                 l->stat.wait_total;
+             j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = l;
+    }
+
+    printf("Lock statistics (TSC cycles):\n");
+    printf("%-16s %10s %10s %14s %12s %14s\n", "lock", "acquired",
+           "contended", "wait total", "wait max", "hold total");
+    for (i = 0; i < cnt; i++) print_lock_stat(&sorted[i]->stat);
+    print_lock_stat(&unnamed_stat);
+}
+#endif
+
+/* Priority donation.
+
+   Each lock remembers the highest priority among the threads
+   waiting for it, and each thread keeps the locks it holds in a
+   max-heap ordered by that priority.  A thread's priority is its
+   base priority or the top of its heap, whichever is higher, so
+   dropping a lock's donations on release is a heap removal
+   rather than a walk over every donor.
+
+   The heap is a pairing heap linked through the locks
+   themselves, so a thread may hold any number of locks.  A lock's
+   heap_child is its first child and heap_next its next sibling;
+   heap_prev is its previous sibling, or its parent if it is the
+   first child.  Raising a lock's priority cuts its subtree out
+   and melds it back in at the root, and removing a lock melds its
+   children together in pairs, which takes O(log n) amortized
+   time.
+
+   Every holder's heap, every lock's `holder' and `max_priority',
+   and every thread's `waiting_lock' and `base_priority' are
+   protected by donation_lock, which is taken with interrupts off
+   and before any semaphore or run queue lock.  Donation has to
+   follow chains of locks and holders, so it is serialized as a
+   whole, but an uncontended semaphore never takes this lock. */
+static struct spinlock donation_lock;
+
+/* Melds the heaps rooted at A and B, neither of which may have
+   siblings, and returns the root of the result. */
+static struct lock* held_meld(struct lock* a, struct lock* b) {
+    if (a == NULL) return b;
+    if (b == NULL) return a;
+    if (a->max_priority < b->max_priority)
+    {
+        struct lock* tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    b->heap_prev = a;
+    b->heap_next = a->heap_child;
+    if (a->heap_child != NULL) a->heap_child->heap_prev = b;
+    a->heap_child = b;
+    return a;
+}
+
+/* Melds FIRST and its siblings into one heap and returns its
+   root: first in pairs from left to right, then those pairs from
+   right to left. */
+static struct lock* held_meld_pairs(struct lock* first) {
+    struct lock* pairs = NULL; /* Melded pairs, last first. */
+    struct lock* root = NULL;
+
+    while (first != NULL)
+    {
+        struct lock* a = first;
+        struct lock* b = a->heap_next;
+
+        first = b != NULL ? b->heap_next : NULL;
+        a->heap_prev = a->heap_next = NULL;
+        if (b != NULL) b->heap_prev = b->heap_next = NULL;
+
+        a = held_meld(a, b);
+        a->heap_next = pairs;
+        pairs = a;
+    }
+    while (pairs != NULL)
+    {
+        struct lock* next = pairs->heap_next;
+
+        pairs->heap_next = NULL;
+        root = held_meld(root, pairs);
+        pairs = next;
+    }
+    return root;
+}
+
+/* Detaches the subtree rooted at LOCK, which must not be the
+   root of its heap, from its parent and siblings. */
+static void held_cut(struct lock* lock) {
+    if (lock->heap_prev->heap_child == lock)
+        lock->heap_prev->heap_child = lock->heap_next;
+    else
+        lock->heap_prev->heap_next = lock->heap_next;
+    if (lock->heap_next != NULL) lock->heap_next->heap_prev = lock->heap_prev;
+    lock->heap_prev = lock->heap_next = NULL;
+}
+
+/* Records that T now holds LOCK. */
+static void held_push(struct thread* t, struct lock* lock) {
+    lock->heap_child = lock->heap_prev = lock->heap_next = NULL;
+    t->held_locks = held_meld(t->held_locks, lock);
+}
+
+/* Records that T no longer holds LOCK. */
+static void held_remove(struct thread* t, struct lock* lock) {
+    struct lock* children = lock->heap_child;
+
+    if (t->held_locks == lock)
+        t->held_locks = held_meld_pairs(children);
+    else
+    {
+        held_cut(lock);
+        t->held_locks = held_meld(t->held_locks, held_meld_pairs(children));
+    }
+    lock->heap_child = NULL;
+}
+
+/* Restores T's heap after LOCK's priority has been raised. */
+static void held_raise(struct thread* t, struct lock* lock) {
+    if (t->held_locks == lock) return;
+
+    held_cut(lock);
+    t->held_locks = held_meld(t->held_locks, lock);
+}
+
+/* Returns the highest priority donated to T through the locks it
+   holds, or -1 if there is none. */
+static int donated_priority(const struct thread* t) {
+    return t->held_locks != NULL ? t->held_locks->max_priority : -1;
+}
+
+/* Sets T's base priority to PRIORITY.  Its effective priority
+   stays at least as high as what it is donated. */
+void lock_set_base_priority(struct thread* t, int priority) {
+    enum intr_level old_level = intr_disable();
+    int donated;
+
+    spin_lock(&donation_lock);
+    donated = donated_priority(t);
+    t->base_priority = priority;
+    thread_update_priority(t, priority > donated ? priority : donated);
+    spin_unlock(&donation_lock);
+    intr_set_level(old_level);
+}
+
+/* Returns the highest priority among LOCK's waiters, or -1 if
+   there are none.  The lock's semaphore must be locked. */
+static int waiters_max_priority(struct lock* lock) {
+    struct list* waiters = &lock->semaphore.waiters;
+
+    if (list_empty(waiters)) return -1;
+    return list_entry(list_min(waiters, high_priority_first, NULL),
+                      struct thread, elem)
+        ->priority;
+}
+
+/* Donates PRIORITY through LOCK to its holder, and on along the
+   chain of locks that holders are themselves waiting for.  Stops
+   as soon as a lock or holder already has at least PRIORITY,
+   because everything further down the chain has it, too.  Whoever
+   wakes a holder that is waiting picks the highest-priority
+   waiter then, so the wait lists need no reordering. */
+static void donate_priority(struct lock* lock, int priority) {
+    while (lock != NULL && lock->holder != NULL &&
+           lock->max_priority < priority)
+    {
+        struct thread* holder = lock->holder;
+
+        lock->max_priority = priority;
+        held_raise(holder, lock);
+        if (holder->priority >= priority) break;
+
+        thread_update_priority(holder, priority);
+        lock = holder->waiting_lock;
+    }
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -211,32 +485,60 @@ void lock_acquire(struct lock* lock) {
     ASSERT(!lock_held_by_current_thread(lock));
 
     struct thread* curr = thread_current();
+    struct semaphore* sema = &lock->semaphore;
+    enum intr_level old_level;
+#ifdef LOCKSTAT
+    uint64_t start = rdtsc();
+    bool contended = lock->holder != NULL;
+#endif
 
-    // If lock is held by another thread, donate priority
-    if (lock->holder != NULL)
+    // The 4.4BSD scheduler does not use donation
+    if (thread_mlfqs)
     {
-        curr->waiting_lock = lock;
-        list_insert_ordered(&lock->holder->donation_list, &curr->donation_elem,
-                            high_priority_first, NULL);
-
-        // Update holder's priority if needed
-        if (curr->priority > lock->holder->priority)
-        {
-            lock->holder->priority = curr->priority;
+        sema_down(sema);
+        old_level = intr_disable();
+        lock->holder = curr;
+#ifdef LOCKSTAT
+        lockstat_acquired(lock, start, contended);
+#endif
+        intr_set_level(old_level);
+        return;
+    }
 
-            // If holder is waiting on a semaphore, reorder it
-            if (lock->holder->waiting_sema != NULL)
-                reorder_sema_waiters(lock->holder->waiting_sema);
+    /* This is sema_down(), except that whenever the lock is held,
+       we donate our priority to its holder before going to sleep
+       and do so atomically with respect to its release. */
+    old_level = intr_disable();
+    spin_lock(&donation_lock);
+    for (;;)
+    {
+        spin_lock(&sema->lock);
+        if (sema->value > 0) break;
 
-            update_donation_chain(lock->holder);  // 연쇄 기부
-        }
+        curr->waiting_lock = lock;
+        donate_priority(lock, curr->priority);
+        list_push_back(&sema->waiters, &curr->elem);
+        spin_unlock(&donation_lock);
+        thread_block_locked(&sema->lock);
+        spin_lock(&donation_lock);
     }
+    sema->value--;
 
-    sema_down(&lock->semaphore);
+    /* Whoever is still waiting now donates to us. */
+    lock->max_priority = waiters_max_priority(lock);
+    spin_unlock(&sema->lock);
 
     // After acquiring lock
-    lock->holder = thread_current();
+    lock->holder = curr;
     curr->waiting_lock = NULL;
+    held_push(curr, lock);
+    if (lock->max_priority > curr->priority)
+        thread_update_priority(curr, lock->max_priority);
+#ifdef LOCKSTAT
+    lockstat_acquired(lock, start, contended);
+#endif
+    spin_unlock(&donation_lock);
+    intr_set_level(old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -246,13 +548,34 @@ void lock_acquire(struct lock* lock) {
    This function will not sleep, so it may be called within an
    interrupt handler. */
 bool lock_try_acquire(struct lock* lock) {
+    struct semaphore* sema = &lock->semaphore;
+    enum intr_level old_level;
     bool success;
 
     ASSERT(lock != NULL);
     ASSERT(!lock_held_by_current_thread(lock));
 
-    success = sema_try_down(&lock->semaphore);
-    if (success) lock->holder = thread_current();
+    old_level = intr_disable();
+    spin_lock(&donation_lock);
+    spin_lock(&sema->lock);
+    success = sema->value > 0;
+    if (success)
+    {
+        sema->value--;
+        lock->max_priority = waiters_max_priority(lock);
+    }
+    spin_unlock(&sema->lock);
+
+    if (success)
+    {
+        lock->holder = thread_current();
+        if (!thread_mlfqs) held_push(lock->holder, lock);
+#ifdef LOCKSTAT
+        lockstat_acquired(lock, 0, false);
+#endif
+    }
+    spin_unlock(&donation_lock);
+    intr_set_level(old_level);
     return success;
 }
 
@@ -267,34 +590,30 @@ void lock_release(struct lock* lock) {
     ASSERT(lock_held_by_current_thread(lock));
 
     struct thread* curr = thread_current();
+    enum intr_level old_level = intr_disable();
 
-    // Remove all donations to this thread and recalculate priority
-    struct list_elem* e = list_begin(&curr->donation_list);
-    while (e != list_end(&curr->donation_list))
-    {
-        struct thread* donor = list_entry(e, struct thread, donation_elem);
-        if (donor->waiting_lock == lock)
-            e = list_remove(e);
-        else
-            e = list_next(e);
-    }
+#ifdef LOCKSTAT
+    lockstat_released(lock);
+#endif
 
-    // Recalculate priority
-    if (list_empty(&curr->donation_list))
-    {
-        curr->priority = curr->base_priority;
-    }
-    else
+    // Drop this lock's donations and recalculate priority
+    spin_lock(&donation_lock);
+    if (!thread_mlfqs)
     {
-        struct list_elem* max_elem =
-            list_max(&curr->donation_list, high_priority_donation_elem, NULL);
-        struct thread* max_donor =
-            list_entry(max_elem, struct thread, donation_elem);
-        curr->priority = max_donor->priority;
+        int donated;
+
+        held_remove(curr, lock);
+        lock->max_priority = -1;
+        donated = donated_priority(curr);
+        thread_update_priority(curr, curr->base_priority > donated
+                                         ? curr->base_priority
+                                         : donated);
     }
-
     lock->holder = NULL;
+    spin_unlock(&donation_lock);
+
     sema_up(&lock->semaphore);
+    intr_set_level(old_level);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -411,3 +730,148 @@ void cond_broadcast(struct condition* cond, struct lock* lock) {
 
     while (!list_empty(&cond->waiters)) cond_signal(cond, lock);
 }
+
+/* Initializes RW as a readers-writer lock held by nobody. */
+void rwlock_init(struct rwlock* rw) {
+    ASSERT(rw != NULL);
+
+    lock_init(&rw->lock);
+    spin_init(&rw->count_lock);
+    rw->readers = 0;
+    rw->draining = false;
+    sema_init(&rw->drained, 0);
+}
+
+/* Acquires RW for reading, sleeping until no writer holds or is
+   waiting ahead of us for it.  A thread must not acquire RW for
+   reading again while it already holds it, because a writer that
+   arrived in between would deadlock with it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void rwlock_read_acquire(struct rwlock* rw) {
+    enum intr_level old_level;
+
+    ASSERT(rw != NULL);
+    ASSERT(!intr_context());
+
+    lock_acquire(&rw->lock);
+    old_level = intr_disable();
+    spin_lock(&rw->count_lock);
+    rw->readers++;
+    spin_unlock(&rw->count_lock);
+    intr_set_level(old_level);
+    lock_release(&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void rwlock_read_release(struct rwlock* rw) {
+    enum intr_level old_level;
+    bool last;
+
+    ASSERT(rw != NULL);
+
+    old_level = intr_disable();
+    spin_lock(&rw->count_lock);
+    ASSERT(rw->readers > 0);
+    last = --rw->readers == 0 && rw->draining;
+    if (last) rw->draining = false;
+    spin_unlock(&rw->count_lock);
+
+    if (last) sema_up(&rw->drained);
+    intr_set_level(old_level);
+}
+
+/* Acquires RW for writing, sleeping until every other reader and
+   writer has released it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void rwlock_write_acquire(struct rwlock* rw) {
+    enum intr_level old_level;
+    bool drain;
+
+    ASSERT(rw != NULL);
+    ASSERT(!intr_context());
+
+    /* Holding the lock keeps new readers out, so READERS only
+       goes down from here. */
+    lock_acquire(&rw->lock);
+    old_level = intr_disable();
+    spin_lock(&rw->count_lock);
+    drain = rw->readers > 0;
+    if (drain) rw->draining = true;
+    spin_unlock(&rw->count_lock);
+    intr_set_level(old_level);
+
+    /* The last reader to leave ups the semaphore, even if it gets
+       there before we go to sleep on it. */
+    if (drain) sema_down(&rw->drained);
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void rwlock_write_release(struct rwlock* rw) {
+    ASSERT(rw != NULL);
+    ASSERT(lock_held_by_current_thread(&rw->lock));
+
+    lock_release(&rw->lock);
+}
+
+/* Turns the current thread's write hold on RW into a read hold
+   without letting any other writer in between.  Readers that
+   were waiting may then proceed. */
+void rwlock_downgrade(struct rwlock* rw) {
+    enum intr_level old_level;
+
+    ASSERT(rw != NULL);
+    ASSERT(lock_held_by_current_thread(&rw->lock));
+
+    old_level = intr_disable();
+    spin_lock(&rw->count_lock);
+    rw->readers++;
+    spin_unlock(&rw->count_lock);
+    intr_set_level(old_level);
+    lock_release(&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing,
+   false otherwise. */
+bool rwlock_write_held_by_current_thread(const struct rwlock* rw) {
+    ASSERT(rw != NULL);
+
+    return lock_held_by_current_thread(&rw->lock);
+}
+
+/* Initializes spinlock LOCK as released. */
+void spin_init(struct spinlock* lock) {
+    ASSERT(lock != NULL);
+
+    lock->locked = 0;
+}
+
+/* Acquires LOCK, spinning until it is released by whoever holds
+   it.  The inner loop only reads the lock word, so that waiting
+   CPUs share its cache line instead of bouncing it around with
+   failed exchanges.  See [IA32-v2b] "PAUSE". */
+void spin_lock(struct spinlock* lock) {
+    ASSERT(lock != NULL);
+
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE))
+        while (lock->locked) asm volatile("pause");
+}
+
+/* Tries to acquire LOCK without spinning.  Returns true if
+   successful, false if LOCK is already held. */
+bool spin_trylock(struct spinlock* lock) {
+    ASSERT(lock != NULL);
+
+    return !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+/* Releases LOCK, which must be held by the caller. */
+void spin_unlock(struct spinlock* lock) {
+    ASSERT(lock != NULL);
+    ASSERT(lock->locked);
+
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
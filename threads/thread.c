@@ -4,11 +4,14 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "intrinsic.h"
-#include "threads/flags.h"
+#include "threads/fixed-point.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/smp.h"
+#include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #ifdef USERPROG
@@ -24,13 +27,38 @@
    Do not modify this value. */
 #define THREAD_BASIC 0xd42df210
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
-static struct list sleep_list;
-
-/* Idle thread. */
-static struct thread* idle_thread;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, sit in the run queue of
+   some CPU (see struct run_queue in smp.h).  A CPU that runs out
+   of work steals from the others before going idle.
+
+   Each run queue has a spinlock of its own, taken with interrupts
+   off.  It protects the queue and the `status' and `priority' of
+   every thread whose `cpu' is that CPU, and `cpu' itself changes
+   only under the lock of the CPU it pointed to.  A CPU holds its
+   own lock from the moment it picks the next thread until that
+   thread is running (see schedule()), and otherwise takes at
+   most one run queue lock at a time, except that stealing only
+   tries for the second one.
+
+   The same lock covers the 4.4BSD scheduler's per-thread state,
+   and each run queue keeps the list of threads charged on its
+   CPU, so that a timer tick takes only its own CPU's lock.  A
+   thread on that list always belongs to that CPU: before a
+   thread moves, mlfqs_settle() takes it off.  all_lock is only
+   on the tick path of the BSP, once per second. */
+
+/* List of all live threads, for the 4.4BSD scheduler's
+   once-per-second recalculation. */
+static struct list all_list;
+
+/* Protects all_list and load_avg.  May be taken before a run
+   queue lock, never after. */
+static struct spinlock all_lock;
+
+/* Returns true if T is some CPU's idle thread.  Idle threads
+   never migrate, so T->cpu is always the CPU it idles for. */
+#define is_idle_thread(t) ((t) == (t)->cpu->idle_thread)
 
 /* Initial thread, the thread running init.c:main(). */
 static struct thread* initial_thread;
@@ -38,31 +66,62 @@ static struct thread* initial_thread;
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
-/* Thread destruction requests */
-static struct list destruction_req;
+/* Pages of recently destroyed threads, most recent first, kept
+   for reuse by thread_create() instead of going back to the page
+   allocator.  Linked through the dead threads' `elem'. */
+#define THREAD_PAGE_CACHE_MAX 16
+static struct list thread_page_cache;
+static size_t thread_page_cache_cnt;
+static struct spinlock thread_page_lock;
 
-/* Statistics. */
+/* Statistics, updated atomically by every CPU's timer. */
 static long long idle_ticks;   /* # of timer ticks spent idle. */
 static long long kernel_ticks; /* # of timer ticks in kernel threads. */
 static long long user_ticks;   /* # of timer ticks in user programs. */
 
 /* Scheduling. */
-#define TIME_SLICE 4          /* # of timer ticks to give each thread. */
-static unsigned thread_ticks; /* # of timer ticks since last yield. */
+#define TIME_SLICE 4 /* # of timer ticks to give each thread. */
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* 4.4BSD scheduler state. */
+#define NICE_MIN -20
+#define NICE_MAX 20
+#define PRI_RECALC_TICKS 4  /* Ticks between priority updates. */
+static fixed_t load_avg;    /* System load average. */
+
 static void print_list(struct list* L);
-static void kernel_thread(thread_func*, void* aux);
+static void kernel_thread(thread_func*, void* aux, struct thread* prev);
 
 static void idle(void* aux UNUSED);
+static void idle_loop(void) NO_RETURN;
+static void mlfqs_tick(struct thread*);
+static int mlfqs_priority(const struct thread*);
+static void mlfqs_update_priority(struct thread*);
+static void mlfqs_settle(struct thread*);
+static void mlfqs_decay(void);
+static void rq_init(struct run_queue*);
+static void rq_set_priority(struct thread*, int priority);
+static void ready_push(struct thread*);
+static void ready_remove(struct thread*);
+static struct thread* rq_pop(struct run_queue*, int pri);
+static int rq_max_priority(const struct run_queue*);
+static int ready_max_priority(void);
+static struct cpu* thread_rq_lock(struct thread*);
+static struct cpu* select_cpu(struct thread*);
+static bool steal_thread(struct cpu*);
 static struct thread* next_thread_to_run(void);
 static void init_thread(struct thread*, const char* name, int priority);
+static void* alloc_frame(struct thread*, size_t size);
+static struct thread* thread_page_get(void);
+static void thread_page_put(struct thread*);
+static void thread_page_trim(void);
 static void do_schedule(int status);
 static void schedule(void);
+static void schedule_tail(struct thread* prev);
 static tid_t allocate_tid(void);
 
 /* Returns true if T appears to point to a valid thread. */
@@ -105,15 +164,19 @@ void thread_init(void) {
 
     /* Init the globla thread context */
     lock_init(&tid_lock);
-    list_init(&ready_list);
-    list_init(&sleep_list);
-    list_init(&destruction_req);
+    lock_set_name(&tid_lock, "tid");
+    rq_init(&cpu_current()->rq);
+    list_init(&all_list);
+    spin_init(&all_lock);
+    list_init(&thread_page_cache);
+    spin_init(&thread_page_lock);
 
     /* Set up a thread structure for the running thread. */
     initial_thread = running_thread();
     init_thread(initial_thread, "main", PRI_DEFAULT);
     initial_thread->status = THREAD_RUNNING;
     initial_thread->tid = allocate_tid();
+    cpu_current()->curr = initial_thread;
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
@@ -131,48 +194,61 @@ void thread_start(void) {
     sema_down(&idle_started);
 }
 
+/* Sets up the idle thread for application processor C, which
+   is not running yet, and returns it.  The AP starts out on the
+   idle thread's stack and turns into it in thread_start_ap(). */
+struct thread* thread_prepare_ap(struct cpu* c) {
+    struct thread* t;
+    char name[16];
+
+    t = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+    snprintf(name, sizeof name, "idle%d", c->id);
+    init_thread(t, name, PRI_MIN);
+    t->tid = allocate_tid();
+    t->cpu = c;
+
+    rq_init(&c->rq);
+    c->idle_thread = c->curr = t;
+    return t;
+}
+
+/* Starts scheduling on the calling application processor, which
+   must be running on the stack of the thread that
+   thread_prepare_ap() returned for it, with interrupts off. */
+void thread_start_ap(void) {
+    struct thread* t = running_thread();
+    struct cpu* c = cpu_current();
+
+    ASSERT(intr_get_level() == INTR_OFF);
+    ASSERT(t == c->idle_thread);
+
+    t->status = THREAD_RUNNING;
+    c->started = true;
+    idle_loop();
+}
+
 /* Called by the timer interrupt handler at each timer tick.
    Thus, this function runs in an external interrupt context. */
 void thread_tick(void) {
+    struct cpu* c = cpu_current();
     struct thread* t = thread_current();
 
     /* Update statistics. */
-    if (t == idle_thread) idle_ticks++;
+    if (t == c->idle_thread)
+        __atomic_fetch_add(&idle_ticks, 1, __ATOMIC_RELAXED);
 #ifdef USERPROG
     else if (t->pml4 != NULL)
-        user_ticks++;
+        __atomic_fetch_add(&user_ticks, 1, __ATOMIC_RELAXED);
 #endif
     else
-        kernel_ticks++;
+        __atomic_fetch_add(&kernel_ticks, 1, __ATOMIC_RELAXED);
 
-    /* Enforce preemption. */
-    if (++thread_ticks >= TIME_SLICE) intr_yield_on_return();
-}
-void insert_sleep_list(void) {
-    struct thread* curr = thread_current();
+    if (thread_mlfqs) mlfqs_tick(t);
 
-    if (curr != idle_thread)
-        list_insert_ordered(&sleep_list, &curr->elem, sooner_first, NULL);
-}
-
-// wakeup_time 정렬된 것을 활용해 깨울만큼 깨운다.(thread_unblock)
-void awake(int64_t total_elapsed) {
-    if (list_empty(&sleep_list)) return;  // early return
-
-    struct thread* front =
-        list_entry(list_front(&sleep_list), struct thread, elem);
-
-    size_t len = list_size(&sleep_list);
-
-    for (size_t i = 0; i < len; i++)
-    {
-        if (front->wakeup_time - total_elapsed > 0) return;
-
-        struct list_elem* next = list_remove(&front->elem);
-        thread_unblock(front);
-
-        front = list_entry(next, struct thread, elem);
-    }
+    /* Enforce preemption.  The idle thread gives up the CPU by
+       itself as soon as it wakes up, so it is never preempted. */
+    if (t != c->idle_thread && ++c->thread_ticks >= TIME_SLICE)
+        intr_yield_on_return();
 }
 
 /* Prints thread statistics. */
@@ -201,37 +277,53 @@ tid_t thread_create(const char* name,
                     thread_func* function,
                     void* aux) {
     struct thread* t;
+    struct switch_threads_frame* sf;
     tid_t tid;
 
     ASSERT(function != NULL);
 
     /* Allocate thread. */
-    t = palloc_get_page(PAL_ZERO);
+    t = thread_page_get();
     if (t == NULL) return TID_ERROR;
 
-    /* Initialize thread. */
+    /* Initialize thread.  Under the 4.4BSD scheduler, a new
+       thread inherits its parent's niceness and recent CPU and
+       its priority is computed from those. */
     init_thread(t, name, priority);
     tid = t->tid = allocate_tid();
+    if (thread_mlfqs)
+    {
+        enum intr_level old_level = intr_disable();
+        struct cpu* c = cpu_current();
+
+        /* T starts out on our CPU, so our lock covers it too. */
+        ASSERT(t->cpu == c);
+        spin_lock(&c->rq.lock);
+        t->nice = thread_current()->nice;
+        t->recent_cpu = thread_current()->recent_cpu;
+        mlfqs_update_priority(t);
+        spin_unlock(&c->rq.lock);
+        intr_set_level(old_level);
+    }
 
-    /* Call the kernel_thread if it scheduled.
-     * Note) rdi is 1st argument, and rsi is 2nd argument. */
-    t->tf.rip = (uintptr_t)kernel_thread;
-    t->tf.R.rdi = (uint64_t)function;
-    t->tf.R.rsi = (uint64_t)aux;
-    t->tf.ds = SEL_KDSEG;
-    t->tf.es = SEL_KDSEG;
-    t->tf.ss = SEL_KDSEG;
-    t->tf.cs = SEL_KCSEG;
-    t->tf.eflags = FLAG_IF;
-
-    /* Add to run queue. */
+    /* Stack frame for switch_threads(), which "returns" into
+       switch_entry(), which calls kernel_thread(FUNCTION, AUX,
+       PREV) with the thread that switched to us as PREV.  The
+       thread starts with interrupts off and its CPU's run queue
+       locked, as the scheduler leaves them, and kernel_thread()
+       releases both. */
+    sf = alloc_frame(t, sizeof *sf);
+    sf->rip = switch_entry;
+    sf->rbx = (uint64_t)kernel_thread;
+    sf->r12 = (uint64_t)function;
+    sf->r13 = (uint64_t)aux;
+    sf->rbp = 0;
+
+    /* Add to run queue.  This yields right away if T should run
+       here instead of us.  T may even be gone by the time it
+       returns, so T must not be touched afterward. */
     thread_unblock(t);
 
-    // 새로운 쓰레드가 ready_list에 추가 된 때,
-    // 그것이 만약 현재 running 쓰레드보다 우선순위가 높다면
-    // 새로운 쓰레드에게 즉시 CPU 양보
-    if (t->priority > thread_current()->priority) thread_yield();
-
     return tid;
 }
 
@@ -242,25 +334,29 @@ tid_t thread_create(const char* name,
    is usually a better idea to use one of the synchronization
    primitives in synch.h. */
 void thread_block(void) {
-    struct thread* curr = thread_current();
-
     ASSERT(!intr_context());
     ASSERT(intr_get_level() == INTR_OFF);
 
-    curr->status = THREAD_BLOCKED;
-    schedule();
+    do_schedule(THREAD_BLOCKED);
 }
 
-// 빨랑 깨워야하는 애들부터 정렬
-bool sooner_first(const struct list_elem* a,
-                  const struct list_elem* b,
-                  void* _) {
-    int64_t wakeupA = list_entry(a, struct thread, elem)->wakeup_time;
-    int64_t wakeupB = list_entry(b, struct thread, elem)->wakeup_time;
+/* Puts the current thread to sleep and releases spinlock LOCK,
+   atomically with respect to thread_unblock(): a thread that
+   takes LOCK afterward and finds the current thread waiting may
+   unblock it right away.  LOCK is not held on return.
 
-    if (wakeupA - wakeupB <= 0) return true;
+   This function must be called with interrupts turned off, and
+   LOCK must be the only spinlock that the caller holds. */
+void thread_block_locked(struct spinlock* lock) {
+    struct cpu* c = cpu_current();
 
-    return false;
+    ASSERT(!intr_context());
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    spin_lock(&c->rq.lock);
+    thread_current()->status = THREAD_BLOCKED;
+    spin_unlock(lock);
+    schedule();
 }
 
 bool high_priority_first(const struct list_elem* a,
@@ -284,17 +380,41 @@ bool high_priority_first(const struct list_elem* a,
    update other data. */
 void thread_unblock(struct thread* t) {
     enum intr_level old_level;
+    struct cpu *c, *target;
+    bool preempt;
 
     ASSERT(is_thread(t));
 
     old_level = intr_disable();
+    c = thread_rq_lock(t);
     ASSERT(t->status == THREAD_BLOCKED);
-    list_insert_ordered(&ready_list, &t->elem, high_priority_first, NULL);
+
+    /* Nobody else looks for a blocked thread on a run queue, so T
+       can move without holding both locks at once. */
+    target = select_cpu(t);
+    if (target != c)
+    {
+        if (t->charged) mlfqs_settle(t);
+        t->cpu = target;
+        spin_unlock(&c->rq.lock);
+        c = target;
+        spin_lock(&c->rq.lock);
+    }
+    ready_push(t);
     t->status = THREAD_READY;
+    preempt = c->curr == c->idle_thread || t->priority > c->curr->priority;
+    spin_unlock(&c->rq.lock);
 
+    if (!preempt)
+        ;
+    else if (c != cpu_current())
+    {
+        /* Queued on another CPU: kick it, since it is idle or
+           running something less important. */
+        smp_send_resched(c);
+    }
     // 새로 깨어난 t의 우선순위가 현재 스레드보다 높은지 확인
-    if (thread_current() != idle_thread &&
-        t->priority > thread_current()->priority)
+    else if (thread_current() != c->idle_thread)
     {
         if (intr_context())
             intr_yield_on_return();  // 인터럽트가 끝나면 스케줄링
@@ -335,10 +455,18 @@ void thread_exit(void) {
 #ifdef USERPROG
     process_exit();
 #endif
+    malloc_thread_exit();
+    thread_page_trim();
 
     /* Just set our status to dying and schedule another process.
        We will be destroyed during the call to schedule_tail(). */
     intr_disable();
+    spin_lock(&all_lock);
+    list_remove(&thread_current()->allelem);
+    spin_unlock(&all_lock);
+    spin_lock(&cpu_current()->rq.lock);
+    if (thread_current()->charged) list_remove(&thread_current()->charged_elem);
+    spin_unlock(&cpu_current()->rq.lock);
     do_schedule(THREAD_DYING);
     NOT_REACHED();
 }
@@ -346,97 +474,211 @@ void thread_exit(void) {
 /* Yields the CPU.  The current thread is not put to sleep and
    may be scheduled again immediately at the scheduler's whim. */
 void thread_yield(void) {
-    struct thread* curr = thread_current();
     enum intr_level old_level;
 
     ASSERT(!intr_context());
 
     old_level = intr_disable();
-    if (curr != idle_thread)
-        list_insert_ordered(&ready_list, &curr->elem, high_priority_first,
-                            NULL);
     do_schedule(THREAD_READY);
     intr_set_level(old_level);
 }
 
-bool high_priority_donation_elem(const struct list_elem* a,
-                                 const struct list_elem* b,
-                                 void* _) {
-    struct thread* ta = list_entry(a, struct thread, donation_elem);
-    struct thread* tb = list_entry(b, struct thread, donation_elem);
-    return ta->priority < tb->priority;
-}
-
 /* Sets the current thread's priority to NEW_PRIORITY. */
 void thread_set_priority(int new_priority) {
+    /* The 4.4BSD scheduler computes priorities by itself. */
+    if (thread_mlfqs) return;
+
+    lock_set_base_priority(thread_current(), new_priority);
+    if (ready_max_priority() > thread_get_priority()) thread_yield();
+}
+
+/* Changes T's effective priority to PRIORITY.  If T is sitting
+   in a ready queue, it is moved to the queue for its new
+   priority so that next_thread_to_run() stays exact. */
+void thread_update_priority(struct thread* t, int priority) {
+    enum intr_level old_level = intr_disable();
+    struct cpu* c = thread_rq_lock(t);
+
+    rq_set_priority(t, priority);
+    spin_unlock(&c->rq.lock);
+    intr_set_level(old_level);
+}
+
+/* Returns the current thread's priority. */
+int thread_get_priority(void) { return thread_current()->priority; }
+
+/* Sets the current thread's nice value to NICE and recomputes
+   its priority, yielding if it no longer has the highest
+   priority. */
+void thread_set_nice(int nice) {
     struct thread* curr = thread_current();
-    curr->base_priority = new_priority;
+    enum intr_level old_level;
 
-    // Recalculate effective priority
-    if (list_empty(&curr->donation_list))
-    {
-        curr->priority = new_priority;
-    }
-    else
-    {
-        // Find maximum donated priority
-        struct list_elem* max_elem =
-            list_max(&curr->donation_list, high_priority_donation_elem, NULL);
-        struct thread* max_donor =
-            list_entry(max_elem, struct thread, donation_elem);
-        curr->priority = max_donor->priority;
-    }
+    if (nice < NICE_MIN) nice = NICE_MIN;
+    if (nice > NICE_MAX) nice = NICE_MAX;
 
-    if (list_empty(&ready_list)) return;
+    old_level = intr_disable();
+    spin_lock(&cpu_current()->rq.lock);
+    curr->nice = nice;
+    mlfqs_update_priority(curr);
+    spin_unlock(&cpu_current()->rq.lock);
+    intr_set_level(old_level);
 
-    struct thread* successor =
-        list_entry(list_front(&ready_list), struct thread, elem);
+    if (ready_max_priority() > curr->priority) thread_yield();
+}
 
-    if (successor->priority > curr->priority) thread_yield();
+/* Returns the current thread's nice value. */
+int thread_get_nice(void) { return thread_current()->nice; }
+
+/* Returns 100 times the system load average. */
+int thread_get_load_avg(void) {
+    enum intr_level old_level = intr_disable();
+    int load_avg_100;
+
+    spin_lock(&all_lock);
+    load_avg_100 = fp_round(load_avg * 100);
+    spin_unlock(&all_lock);
+    intr_set_level(old_level);
+
+    return load_avg_100;
 }
 
-// 기부자의 우선순위 변경 시, 기부 받는 쪽(holder)도 업데이트
-void update_donation_chain(struct thread* t) {
-    if (t->waiting_lock == NULL) return;
+/* Returns 100 times the current thread's recent_cpu value. */
+int thread_get_recent_cpu(void) {
+    enum intr_level old_level = intr_disable();
+    int recent_cpu_100;
 
-    struct lock* lock = t->waiting_lock;
-    struct thread* holder = lock->holder;
+    spin_lock(&cpu_current()->rq.lock);
+    recent_cpu_100 = fp_round(thread_current()->recent_cpu * 100);
+    spin_unlock(&cpu_current()->rq.lock);
+    intr_set_level(old_level);
 
-    if (holder == NULL) return;
+    return recent_cpu_100;
+}
+
+/* Per-tick work of the 4.4BSD scheduler; T is the running
+   thread.
+
+   Only T's recent_cpu changes on an ordinary tick, so only
+   threads that were charged CPU since the last priority update
+   need a new priority, and each CPU remembers those it charged
+   on its run queue's `charged' list instead of sweeping every
+   thread.  All of that is under this CPU's own run queue lock.
+   Once per second, the BSP decays load_avg and every thread's
+   recent_cpu in a single pass over all_list. */
+static void mlfqs_tick(struct thread* t) {
+    struct cpu* c = cpu_current();
+
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    spin_lock(&c->rq.lock);
+    if (!is_idle_thread(t))
+    {
+        t->recent_cpu = fp_add_int(t->recent_cpu, 1);
+        if (!t->charged)
+        {
+            t->charged = true;
+            list_push_back(&c->rq.charged, &t->charged_elem);
+        }
+    }
+    if (++c->recalc_ticks >= PRI_RECALC_TICKS)
+    {
+        c->recalc_ticks = 0;
+        while (!list_empty(&c->rq.charged))
+        {
+            struct thread* ct = list_entry(list_pop_front(&c->rq.charged),
+                                           struct thread, charged_elem);
+            ASSERT(ct->cpu == c);
+            ct->charged = false;
+            mlfqs_update_priority(ct);
+        }
+    }
+    spin_unlock(&c->rq.lock);
 
-    // holder의 우선순위가 변경되어야 하는지 확인
-    if (t->priority > holder->priority)
+    if (c->id == 0 && timer_ticks() % TIMER_FREQ == 0)
     {
-        holder->priority = t->priority;
-        // 연쇄적으로 holder도 업데이트 (재귀)
-        update_donation_chain(holder);
+        spin_lock(&all_lock);
+        mlfqs_decay();
+        spin_unlock(&all_lock);
     }
+
+    if (!is_idle_thread(t) && ready_max_priority() > t->priority)
+        intr_yield_on_return();
 }
 
-/* Returns the current thread's priority. */
-int thread_get_priority(void) { return thread_current()->priority; }
+/* Returns the priority that T's recent_cpu and nice value call
+   for. */
+static int mlfqs_priority(const struct thread* t) {
+    int priority = PRI_MAX - fp_to_int(t->recent_cpu / 4) - t->nice * 2;
 
-/* Sets the current thread's nice value to NICE. */
-void thread_set_nice(int nice UNUSED) {
-    /* TODO: Your implementation goes here */
+    if (priority < PRI_MIN) priority = PRI_MIN;
+    if (priority > PRI_MAX) priority = PRI_MAX;
+    return priority;
 }
 
-/* Returns the current thread's nice value. */
-int thread_get_nice(void) {
-    /* TODO: Your implementation goes here */
-    return 0;
+/* Recomputes T's priority from its recent_cpu and nice value,
+   moving it to the right ready queue if needed.  T's run queue
+   lock must be held. */
+static void mlfqs_update_priority(struct thread* t) {
+    int priority;
+
+    if (is_idle_thread(t)) return;
+
+    priority = mlfqs_priority(t);
+    t->base_priority = priority;
+    rq_set_priority(t, priority);
 }
 
-/* Returns 100 times the system load average. */
-int thread_get_load_avg(void) {
-    /* TODO: Your implementation goes here */
-    return 0;
+/* Takes T, which is about to move to another CPU, off its CPU's
+   charged list, bringing its priority up to date now instead of
+   at that CPU's next update.  T must not be in a run queue, and
+   its run queue lock must be held. */
+static void mlfqs_settle(struct thread* t) {
+    ASSERT(t->charged);
+
+    list_remove(&t->charged_elem);
+    t->charged = false;
+    t->base_priority = t->priority = mlfqs_priority(t);
 }
 
-/* Returns 100 times the current thread's recent_cpu value. */
-int thread_get_recent_cpu(void) {
-    /* TODO: Your implementation goes here */
-    return 0;
+/* Once-per-second update: recomputes load_avg, then decays
+   every thread's recent_cpu and refreshes its priority, all in
+   one pass over all_list, taking each thread's run queue lock in
+   turn.  The run queues are counted without their locks, which
+   is close enough for an average.  all_lock must be held. */
+static void mlfqs_decay(void) {
+    int ready_threads = 0;
+    fixed_t twice_load, coef;
+    struct list_elem* e;
+
+    for (int i = 0; i < cpu_cnt; i++)
+        ready_threads += cpus[i].rq.cnt +
+                         (cpus[i].curr != cpus[i].idle_thread ? 1 : 0);
+
+    load_avg = fp_mul(fp_div(fp_from_int(59), fp_from_int(60)), load_avg) +
+               fp_from_int(ready_threads) / 60;
+
+    twice_load = load_avg * 2;
+    coef = fp_div(twice_load, fp_add_int(twice_load, 1));
+
+    for (e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e))
+    {
+        struct thread* t = list_entry(e, struct thread, allelem);
+        struct cpu* c;
+
+        if (is_idle_thread(t)) continue;
+        c = thread_rq_lock(t);
+        t->recent_cpu = fp_add_int(fp_mul(coef, t->recent_cpu), t->nice);
+        mlfqs_update_priority(t);
+
+        /* T is up to date now. */
+        if (t->charged)
+        {
+            list_remove(&t->charged_elem);
+            t->charged = false;
+        }
+        spin_unlock(&c->rq.lock);
+    }
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -451,35 +693,44 @@ int thread_get_recent_cpu(void) {
 static void idle(void* idle_started_ UNUSED) {
     struct semaphore* idle_started = idle_started_;
 
-    idle_thread = thread_current();
+    cpu_current()->idle_thread = thread_current();
     sema_up(idle_started);
+    idle_loop();
+}
 
+/* Body of every CPU's idle thread. */
+static void idle_loop(void) {
     for (;;)
     {
         /* Let someone else run. */
         intr_disable();
         thread_block();
 
-        /* Re-enable interrupts and wait for the next one.
+        /* Nothing is runnable, so stop the periodic tick until the
+           next timer deadline.  The PIT also keeps time for the
+           other CPUs, so only do that on a uniprocessor. */
+        if (cpu_cnt == 1) timer_idle_enter();
 
-           The `sti' instruction disables interrupts until the
-           completion of the next instruction, so these two
-           instructions are executed atomically.  This atomicity is
-           important; otherwise, an interrupt could be handled
-           between re-enabling interrupts and waiting for the next
-           one to occur, wasting as much as one clock tick worth of
-           time.
+        /* Re-enable interrupts and wait for the next one.  Doing
+           both atomically is important; otherwise, an interrupt
+           could be handled between re-enabling interrupts and
+           waiting for the next one to occur, wasting as much as one
+           clock tick worth of time. */
+        intr_wait();
 
-           See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
-           7.11.1 "HLT Instruction". */
-        asm volatile("sti; hlt" : : : "memory");
+        intr_disable();
+        timer_idle_exit();
     }
 }
 
-/* Function used as the basis for a kernel thread. */
-static void kernel_thread(thread_func* function, void* aux) {
+/* Function used as the basis for a kernel thread.  PREV is the
+   thread that the scheduler switched away from to start us. */
+static void kernel_thread(thread_func* function,
+                          void* aux,
+                          struct thread* prev) {
     ASSERT(function != NULL);
 
+    schedule_tail(prev);
     intr_enable(); /* The scheduler runs with interrupts off. */
     function(aux); /* Execute the thread function. */
     thread_exit(); /* If function() returns, kill the thread. */
@@ -495,28 +746,260 @@ static void init_thread(struct thread* t, const char* name, int priority) {
     memset(t, 0, sizeof *t);
     t->status = THREAD_BLOCKED;
     strlcpy(t->name, name, sizeof t->name);
-    t->tf.rsp = (uint64_t)t + PGSIZE - sizeof(void*);
+    t->stack = (uint8_t*)t + PGSIZE - 2 * sizeof(void*);
     t->priority = priority;
     t->base_priority = priority;
     t->waiting_lock = NULL;
-    t->waiting_sema = NULL;
-    list_init(&t->donation_list);
+    t->cpu = cpu_current();
     t->magic = THREAD_MAGIC;
+
+    enum intr_level old_level = intr_disable();
+    spin_lock(&all_lock);
+    list_push_back(&all_list, &t->allelem);
+    spin_unlock(&all_lock);
+    intr_set_level(old_level);
+}
+
+/* Returns a page for a new thread, preferring a recycled one,
+   or a null pointer if memory is exhausted.  The page is not
+   zeroed: init_thread() clears the struct thread at its start,
+   and the stack above it needs no clearing. */
+static struct thread* thread_page_get(void) {
+    struct thread* t = NULL;
+    enum intr_level old_level = intr_disable();
+
+    spin_lock(&thread_page_lock);
+    if (!list_empty(&thread_page_cache))
+    {
+        t = list_entry(list_pop_front(&thread_page_cache), struct thread,
+                       elem);
+        thread_page_cache_cnt--;
+    }
+    spin_unlock(&thread_page_lock);
+    intr_set_level(old_level);
+
+    return t != NULL ? t : palloc_get_page(0);
+}
+
+/* Keeps the page of dead thread T for reuse.  The cache may
+   grow past THREAD_PAGE_CACHE_MAX here: freeing a page takes the
+   page allocator's lock, which the scheduler must not sleep on,
+   so thread_page_trim() frees the excess later.  Must be called
+   with interrupts off. */
+static void thread_page_put(struct thread* t) {
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    spin_lock(&thread_page_lock);
+    list_push_front(&thread_page_cache, &t->elem);
+    thread_page_cache_cnt++;
+    spin_unlock(&thread_page_lock);
+}
+
+/* Frees cached thread pages beyond THREAD_PAGE_CACHE_MAX, oldest
+   first.  Must be called from a context that may sleep. */
+static void thread_page_trim(void) {
+    for (;;)
+    {
+        struct thread* t = NULL;
+        enum intr_level old_level = intr_disable();
+
+        spin_lock(&thread_page_lock);
+        if (thread_page_cache_cnt > THREAD_PAGE_CACHE_MAX)
+        {
+            t = list_entry(list_pop_back(&thread_page_cache), struct thread,
+                           elem);
+            thread_page_cache_cnt--;
+        }
+        spin_unlock(&thread_page_lock);
+        intr_set_level(old_level);
+
+        if (t == NULL) break;
+        palloc_free_page(t);
+    }
+}
+
+/* Allocates a SIZE-byte frame at the top of thread T's stack and
+   returns a pointer to the frame's base. */
+static void* alloc_frame(struct thread* t, size_t size) {
+    /* Stack data is always allocated in word-size units. */
+    ASSERT(is_thread(t));
+    ASSERT(size % sizeof(uint64_t) == 0);
+
+    t->stack -= size;
+    return t->stack;
+}
+
+/* Initializes run queue RQ as empty. */
+static void rq_init(struct run_queue* rq) {
+    spin_init(&rq->lock);
+    for (int pri = PRI_MIN; pri <= PRI_MAX; pri++)
+        list_init(&rq->queues[pri]);
+    rq->bitmap = 0;
+    rq->cnt = 0;
+    list_init(&rq->charged);
+}
+
+/* Sets T's priority to PRIORITY, moving it to the right ready
+   queue if it is in one.  T's run queue lock must be held. */
+static void rq_set_priority(struct thread* t, int priority) {
+    if (t->status == THREAD_READY && t->priority != priority)
+    {
+        ready_remove(t);
+        t->priority = priority;
+        ready_push(t);
+    }
+    else
+        t->priority = priority;
+}
+
+/* Appends T to the tail of the ready queue for its priority in
+   T's CPU's run queue, which must be locked. */
+static void ready_push(struct thread* t) {
+    struct run_queue* rq = &t->cpu->rq;
+
+    ASSERT(rq->lock.locked);
+    ASSERT(PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+    list_push_back(&rq->queues[t->priority], &t->elem);
+    rq->bitmap |= 1ULL << t->priority;
+    rq->cnt++;
+}
+
+/* Removes T, which must be in the ready queue for its current
+   priority, from that queue.  T's CPU's run queue must be
+   locked. */
+static void ready_remove(struct thread* t) {
+    struct run_queue* rq = &t->cpu->rq;
+
+    ASSERT(rq->lock.locked);
+
+    list_remove(&t->elem);
+    if (list_empty(&rq->queues[t->priority]))
+        rq->bitmap &= ~(1ULL << t->priority);
+    rq->cnt--;
+}
+
+/* Removes and returns the thread at the front of RQ's queue for
+   priority PRI, which must be nonempty. */
+static struct thread* rq_pop(struct run_queue* rq, int pri) {
+    struct list* queue = &rq->queues[pri];
+    struct thread* t = list_entry(list_pop_front(queue), struct thread, elem);
+
+    if (list_empty(queue)) rq->bitmap &= ~(1ULL << pri);
+    rq->cnt--;
+    return t;
+}
+
+/* Returns the highest priority among threads in RQ, or -1 if RQ
+   is empty.  This is a single `bsr' on its bitmap. */
+static int rq_max_priority(const struct run_queue* rq) {
+    uint64_t bitmap = rq->bitmap;
+
+    if (bitmap == 0) return -1;
+    return 63 - __builtin_clzll(bitmap);
+}
+
+/* Returns the highest priority among threads ready to run on
+   this CPU, or -1 if there are none.  This peeks without the run
+   queue lock, so the answer may be stale by the time the caller
+   acts on it, which only costs an extra or a late yield. */
+static int ready_max_priority(void) {
+    return rq_max_priority(&cpu_current()->rq);
+}
+
+/* Locks the run queue of T's CPU, retrying if T moves to another
+   CPU meanwhile, and returns that CPU.  Interrupts must be off. */
+static struct cpu* thread_rq_lock(struct thread* t) {
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    for (;;)
+    {
+        struct cpu* c = t->cpu;
+
+        spin_lock(&c->rq.lock);
+        if (c == t->cpu) return c;
+        spin_unlock(&c->rq.lock);
+    }
+}
+
+/* Picks the CPU whose run queue T should go on when it becomes
+   ready: the one it last ran on, unless that one is busy and
+   another CPU is sitting idle with nothing queued.  The other
+   CPUs are looked at without their locks; a wrong guess only
+   costs some balance. */
+static struct cpu* select_cpu(struct thread* t) {
+    struct cpu* c = t->cpu;
+
+    if (cpu_cnt == 1 || c->curr == c->idle_thread) return c;
+
+    for (int i = 0; i < cpu_cnt; i++)
+    {
+        struct cpu* o = &cpus[i];
+        if (o->started && o->curr == o->idle_thread && o->rq.cnt == 0)
+            return o;
+    }
+    return c;
+}
+
+/* Moves the highest-priority ready thread queued on any other
+   CPU to C's run queue, which must be locked.  Returns false if
+   there was nothing to steal.
+
+   The victim is chosen by peeking at the other run queues
+   without their locks.  Its lock is only tried, not waited for:
+   its CPU may be trying to steal from us just as well. */
+static bool steal_thread(struct cpu* c) {
+    struct cpu* victim = NULL;
+    int victim_pri = -1;
+
+    for (int i = 0; i < cpu_cnt; i++)
+    {
+        int pri = rq_max_priority(&cpus[i].rq);
+        if (&cpus[i] != c && pri > victim_pri)
+        {
+            victim = &cpus[i];
+            victim_pri = pri;
+        }
+    }
+    if (victim == NULL || !spin_trylock(&victim->rq.lock)) return false;
+
+    victim_pri = rq_max_priority(&victim->rq);
+    if (victim_pri >= 0)
+    {
+        struct thread* t = rq_pop(&victim->rq, victim_pri);
+
+        if (t->charged) mlfqs_settle(t);
+        t->cpu = c;
+        ready_push(t);
+    }
+    spin_unlock(&victim->rq.lock);
+    return victim_pri >= 0;
 }
 
 /* Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
-   empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   return a thread from this CPU's run queue, stealing one from
+   another CPU if ours is empty.  (If the running thread can
+   continue running, then it will be in the run queue.)  If
+   there is nothing to run anywhere, return this CPU's idle
+   thread.  This CPU's run queue must be locked. */
 static struct thread* next_thread_to_run(void) {
-    if (list_empty(&ready_list))
-        return idle_thread;
-    else
-        return list_entry(list_pop_front(&ready_list), struct thread, elem);
+    struct cpu* c = cpu_current();
+    int pri = rq_max_priority(&c->rq);
+
+    if (pri < 0)
+    {
+        if (cpu_cnt == 1 || !steal_thread(c)) return c->idle_thread;
+        pri = rq_max_priority(&c->rq);
+    }
+    return rq_pop(&c->rq, pri);
 }
 
-/* Use iretq to launch the thread */
+/* Offset of `stack' member within `struct thread'.
+   Used by switch.S, which can't figure it out on its own. */
+uint32_t thread_stack_ofs = offsetof(struct thread, stack);
+
+/* Use iretq to enter user mode.  Kernel-to-kernel switches go
+   through switch_threads() instead. */
 void do_iret(struct intr_frame* tf) {
     __asm __volatile(
         "movq %0, %%rsp\n"
@@ -539,135 +1022,85 @@ void do_iret(struct intr_frame* tf) {
         "movw 8(%%rsp),%%ds\n"
         "movw (%%rsp),%%es\n"
         "addq $32, %%rsp\n"
-        "iretq"
+        "cli\n" /* No interrupt may see the user GS base. */
+        "testb $3, 8(%%rsp)\n" /* Entering user mode? */
+        "jz 1f\n"
+        "swapgs\n"
+        "1: iretq"
         :
         : "g"((uint64_t)tf)
         : "memory");
 }
 
-/* Switching the thread by activating the new thread's page
-   tables, and, if the previous thread is dying, destroying it.
-
-   At this function's invocation, we just switched from thread
-   PREV, the new thread is already running, and interrupts are
-   still disabled.
-
-   It's not safe to call printf() until the thread switch is
-   complete.  In practice that means that printf()s should be
-   added at the end of the function. */
-static void thread_launch(struct thread* th) {
-    uint64_t tf_cur = (uint64_t)&running_thread()->tf;
-    uint64_t tf = (uint64_t)&th->tf;
-    ASSERT(intr_get_level() == INTR_OFF);
-
-    /* The main switching logic.
-     * We first restore the whole execution context into the intr_frame
-     * and then switching to the next thread by calling do_iret.
-     * Note that, we SHOULD NOT use any stack from here
-     * until switching is done. */
-    __asm __volatile(
-        /* Store registers that will be used. */
-        "push %%rax\n"
-        "push %%rbx\n"
-        "push %%rcx\n"
-        /* Fetch input once */
-        "movq %0, %%rax\n"
-        "movq %1, %%rcx\n"
-        "movq %%r15, 0(%%rax)\n"
-        "movq %%r14, 8(%%rax)\n"
-        "movq %%r13, 16(%%rax)\n"
-        "movq %%r12, 24(%%rax)\n"
-        "movq %%r11, 32(%%rax)\n"
-        "movq %%r10, 40(%%rax)\n"
-        "movq %%r9, 48(%%rax)\n"
-        "movq %%r8, 56(%%rax)\n"
-        "movq %%rsi, 64(%%rax)\n"
-        "movq %%rdi, 72(%%rax)\n"
-        "movq %%rbp, 80(%%rax)\n"
-        "movq %%rdx, 88(%%rax)\n"
-        "pop %%rbx\n"  // Saved rcx
-        "movq %%rbx, 96(%%rax)\n"
-        "pop %%rbx\n"  // Saved rbx
-        "movq %%rbx, 104(%%rax)\n"
-        "pop %%rbx\n"  // Saved rax
-        "movq %%rbx, 112(%%rax)\n"
-        "addq $120, %%rax\n"
-        "movw %%es, (%%rax)\n"
-        "movw %%ds, 8(%%rax)\n"
-        "addq $32, %%rax\n"
-        "call __next\n"  // read the current rip.
-        "__next:\n"
-        "pop %%rbx\n"
-        "addq $(out_iret -  __next), %%rbx\n"
-        "movq %%rbx, 0(%%rax)\n"  // rip
-        "movw %%cs, 8(%%rax)\n"   // cs
-        "pushfq\n"
-        "popq %%rbx\n"
-        "mov %%rbx, 16(%%rax)\n"  // eflags
-        "mov %%rsp, 24(%%rax)\n"  // rsp
-        "movw %%ss, 32(%%rax)\n"
-        "mov %%rcx, %%rdi\n"
-        "call do_iret\n"
-        "out_iret:\n"
-        :
-        : "g"(tf_cur), "g"(tf)
-        : "memory");
-}
-
 /* Schedules a new process. At entry, interrupts must be off.
  * This function modify current thread's status to status and then
- * finds another thread to run and switches to it.
+ * finds another thread to run and switches to it.  A thread that
+ * stays ready goes back on this CPU's run queue first.
  * It's not safe to call printf() in the schedule(). */
 static void do_schedule(int status) {
+    struct cpu* c = cpu_current();
+    struct thread* curr = thread_current();
+
     ASSERT(intr_get_level() == INTR_OFF);
-    ASSERT(thread_current()->status == THREAD_RUNNING);
-    while (!list_empty(&destruction_req))
-    {
-        struct thread* victim =
-            list_entry(list_pop_front(&destruction_req), struct thread, elem);
-        palloc_free_page(victim);
-    }
-    thread_current()->status = status;
+
+    spin_lock(&c->rq.lock);
+    if (status == THREAD_READY && !is_idle_thread(curr)) ready_push(curr);
+    curr->status = status;
     schedule();
 }
 
+/* Switches from the running thread, whose status must already
+   have been changed, to the next thread to run.  This CPU's run
+   queue must be locked.  The lock stays held across the switch,
+   so that no other CPU can pick up the outgoing thread while it
+   is still using its stack, and schedule_tail() releases it on
+   the other side. */
 static void schedule(void) {
+    struct cpu* c = cpu_current();
     struct thread* curr = running_thread();
     struct thread* next = next_thread_to_run();
 
     ASSERT(intr_get_level() == INTR_OFF);
+    ASSERT(c->rq.lock.locked);
     ASSERT(curr->status != THREAD_RUNNING);
     ASSERT(is_thread(next));
     /* Mark us as running. */
     next->status = THREAD_RUNNING;
+    c->curr = next;
 
     /* Start new time slice. */
-    thread_ticks = 0;
+    c->thread_ticks = 0;
 
 #ifdef USERPROG
     /* Activate the new address space. */
     process_activate(next);
 #endif
 
+    /* Save our callee-saved registers and stack pointer, and pick
+     * up where NEXT left off in its own call to switch_threads(),
+     * which returns the thread that switched to it, which is not
+     * necessarily CURR. */
     if (curr != next)
-    {
-        /* If the thread we switched from is dying, destroy its struct
-           thread. This must happen late so that thread_exit() doesn't
-           pull out the rug under itself.
-           We just queuing the page free reqeust here because the page is
-           currently used by the stack.
-           The real destruction logic will be called at the beginning of the
-           schedule(). */
-        if (curr && curr->status == THREAD_DYING && curr != initial_thread)
-        {
-            ASSERT(curr != next);
-            list_push_back(&destruction_req, &curr->elem);
-        }
+        schedule_tail(switch_threads(curr, next));
+    else
+        schedule_tail(curr);
+}
 
-        /* Before switching the thread, we first save the information
-         * of current running. */
-        thread_launch(next);
-    }
+/* Completes a switch away from PREV to the thread that is now
+   running: unlocks this CPU's run queue, then, if PREV is dying,
+   destroys its struct thread.  This must happen late so that
+   thread_exit() doesn't pull out the rug under itself.  PREV
+   is only reachable from here by then, so its page can be
+   recycled right away.  Anything else may run on another CPU as
+   soon as the lock is released, so PREV's status is read first. */
+static void schedule_tail(struct thread* prev) {
+    struct cpu* c = cpu_current();
+    bool dying = prev->status == THREAD_DYING && prev != initial_thread;
+
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    spin_unlock(&c->rq.lock);
+    if (dying) thread_page_put(prev);
 }
 
 /* Returns a tid to use for a new thread. */
@@ -683,7 +1116,7 @@ static tid_t allocate_tid(void) {
 }
 
 // 리스트 순회하며 이름과 우선순위 printf
-// @param ready_list, sleep_list
+// @param cpu_current()->rq.queues[pri]
 void print_list(struct list* L) {
     printf("------------------- list print START\n");
     if (list_empty(L))
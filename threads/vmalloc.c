@@ -0,0 +1,164 @@
+#include "threads/vmalloc.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include "intrinsic.h"
+#include "threads/init.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/smp.h"
+#include "threads/synch.h"
+
+/* Virtually contiguous allocation.
+
+   palloc_get_multiple() needs physically contiguous pages, which
+   become hard to find as memory fragments.  vmalloc() instead
+   allocates pages one at a time and maps them at consecutive
+   addresses in a region of kernel virtual memory set aside for
+   it.  Memory obtained this way is not in the direct map, so
+   vtop() does not work on it.
+
+   Each allocation is followed by an unmapped guard page.  That
+   catches overruns, and also tells vfree() where an allocation
+   ends without recording its size anywhere.
+
+   vfree() only flushes the freeing CPU's TLB.  Other CPUs may
+   still cache translations for the freed range, which is
+   harmless as long as nothing uses those addresses, so the range
+   stays marked used, and is only recorded in lazy_map.  When
+   vmalloc() runs out of address space, it flushes every CPU's
+   TLB once and then returns all of the lazily freed ranges to
+   use at the same time.  Addresses are handed out next-fit,
+   starting where the last allocation ended, to spread the
+   searches across the region between those flushes. */
+
+/* Number of pages in the vmalloc region. */
+#define VMALLOC_PAGES (VMALLOC_SIZE / PGSIZE)
+
+static struct lock vmalloc_lock; /* Protects all of the below. */
+static struct bitmap* used_map;  /* Pages allocated, including guards. */
+static struct bitmap* lazy_map;  /* Freed pages awaiting a TLB flush. */
+static size_t next_idx;          /* Where to start the next search. */
+static uint8_t used_map_buf[VMALLOC_PAGES / 8 + 64];
+static uint8_t lazy_map_buf[VMALLOC_PAGES / 8 + 64];
+
+/* Returns the page table entry for page IDX of the vmalloc
+   region, creating page tables if CREATE is true.  Returns a null
+   pointer if it does not exist and is not created. */
+static uint64_t* vmalloc_pte(size_t idx, bool create) {
+    return pml4e_walk(base_pml4, VMALLOC_BASE + idx * PGSIZE, create);
+}
+
+/* Initializes the vmalloc region.  Must be called after the
+   kernel page tables are set up. */
+void vmalloc_init(void) {
+    ASSERT(base_pml4 != NULL);
+    ASSERT(PML4(VMALLOC_BASE) == PML4(KERN_BASE));
+    ASSERT(PML4(VMALLOC_BASE + VMALLOC_SIZE - 1) == PML4(KERN_BASE));
+
+    lock_init(&vmalloc_lock);
+    lock_set_name(&vmalloc_lock, "vmalloc");
+    used_map =
+        bitmap_create_in_buf(VMALLOC_PAGES, used_map_buf, sizeof used_map_buf);
+    lazy_map =
+        bitmap_create_in_buf(VMALLOC_PAGES, lazy_map_buf, sizeof lazy_map_buf);
+    next_idx = 0;
+}
+
+/* Flushes every CPU's TLB, after which no stale translation for a
+   lazily freed page can remain, and makes those pages available
+   again.  vmalloc_lock must be held. */
+static void purge_lazy_pages(void) {
+    size_t idx = 0;
+
+    smp_flush_tlb();
+    while ((idx = bitmap_scan_and_flip(lazy_map, idx, 1, true)) !=
+           BITMAP_ERROR)
+        bitmap_reset(used_map, idx);
+}
+
+/* Unmaps and frees the first PAGE_CNT pages at page IDX of the
+   vmalloc region.  vmalloc_lock must be held. */
+static void unmap_pages(size_t idx, size_t page_cnt) {
+    size_t i;
+
+    for (i = 0; i < page_cnt; i++)
+    {
+        uint64_t* pte = vmalloc_pte(idx + i, false);
+
+        ASSERT(pte != NULL && (*pte & PTE_P));
+        palloc_free_page(ptov(PTE_ADDR(*pte)));
+        *pte = 0;
+        invlpg(VMALLOC_BASE + (idx + i) * PGSIZE);
+    }
+}
+
+/* Obtains and returns SIZE bytes of page-aligned, virtually
+   contiguous kernel memory.  Returns a null pointer if there is
+   not enough memory or address space. */
+void* vmalloc(size_t size) {
+    size_t page_cnt = DIV_ROUND_UP(size, PGSIZE);
+    size_t idx, i;
+
+    if (page_cnt == 0) return NULL;
+
+    lock_acquire(&vmalloc_lock);
+    idx = bitmap_scan_and_flip(used_map, next_idx, page_cnt + 1, false);
+    if (idx == BITMAP_ERROR)
+    {
+        /* Wrap around, reclaiming the lazily freed ranges. */
+        purge_lazy_pages();
+        idx = bitmap_scan_and_flip(used_map, 0, page_cnt + 1, false);
+    }
+    if (idx == BITMAP_ERROR)
+    {
+        lock_release(&vmalloc_lock);
+        return NULL;
+    }
+    next_idx = idx + page_cnt + 1;
+
+    for (i = 0; i < page_cnt; i++)
+    {
+        void* kpage = palloc_get_page(0);
+        uint64_t* pte = kpage != NULL ? vmalloc_pte(idx + i, true) : NULL;
+
+        if (pte == NULL)
+        {
+            if (kpage != NULL) palloc_free_page(kpage);
+            unmap_pages(idx, i);
+            bitmap_set_multiple(used_map, idx, page_cnt + 1, false);
+            lock_release(&vmalloc_lock);
+            return NULL;
+        }
+        *pte = vtop(kpage) | PTE_P | PTE_W;
+    }
+    lock_release(&vmalloc_lock);
+
+    return (void*)(VMALLOC_BASE + idx * PGSIZE);
+}
+
+/* Frees P, which must have been returned by vmalloc(). */
+void vfree(void* p) {
+    size_t idx, page_cnt;
+    uint64_t* pte;
+
+    if (p == NULL) return;
+    ASSERT(is_vmalloc_vaddr(p));
+    ASSERT(pg_ofs(p) == 0);
+
+    idx = ((uint64_t)p - VMALLOC_BASE) / PGSIZE;
+
+    lock_acquire(&vmalloc_lock);
+    ASSERT(bitmap_test(used_map, idx) && !bitmap_test(lazy_map, idx));
+
+    /* Count pages up to the guard page. */
+    for (page_cnt = 0;
+         (pte = vmalloc_pte(idx + page_cnt, false)) != NULL && (*pte & PTE_P);
+         page_cnt++)
+        continue;
+
+    unmap_pages(idx, page_cnt);
+    bitmap_set_multiple(lazy_map, idx, page_cnt + 1, true);
+    lock_release(&vmalloc_lock);
+}
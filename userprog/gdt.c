@@ -6,6 +6,8 @@
 #include "threads/vaddr.h"
 #include "userprog/tss.h"
 
+#define MSR_GS_BASE 0xc0000101 /* GS base; points to struct cpu. */
+
 /* The Global Descriptor Table (GDT).
  *
  * The GDT, an x86-64 specific structure, defines segments that can
@@ -91,6 +93,7 @@ void gdt_init(void) {
     struct segment_descriptor64* tss_desc =
         (struct segment_descriptor64*)&gdt[SEL_TSS >> 3];
     struct task_state* tss = tss_get();
+    uint64_t gs_base = read_msr(MSR_GS_BASE);
 
     *tss_desc = (struct segment_descriptor64){
         .lim_15_0 = (uint64_t)(sizeof(struct task_state)) & 0xffff,
@@ -113,6 +116,7 @@ void gdt_init(void) {
     lgdt(&gdt_ds);
     /* reload segment registers */
     asm volatile("movw %%ax, %%gs" ::"a"(SEL_UDSEG));
+    write_msr(MSR_GS_BASE, gs_base); /* Loading %gs cleared it. */
     asm volatile("movw %%ax, %%fs" ::"a"(0));
     asm volatile("movw %%ax, %%es" ::"a"(SEL_KDSEG));
     asm volatile("movw %%ax, %%ds" ::"a"(SEL_KDSEG));
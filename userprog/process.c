@@ -230,8 +230,10 @@ static void process_cleanup(void) {
 /* Sets up the CPU for running user code in the nest thread.
  * This function is called on every context switch. */
 void process_activate(struct thread* next) {
-    /* Activate thread's page tables. */
-    pml4_activate(next->pml4);
+    /* Activate thread's page tables.  A kernel thread only uses
+     * kernel mappings, which every pml4 has, so it keeps whichever
+     * one is active. */
+    if (next->pml4 != NULL) pml4_activate(next->pml4);
 
     /* Set thread's kernel stack for use in processing interrupts. */
     tss_update(next);
@@ -597,12 +599,6 @@ static bool install_page(void* upage, void* kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
-static bool lazy_load_segment(struct page* page, void* aux) {
-    /* TODO: Load the segment from the file */
-    /* TODO: This called when the first page fault occurs on address VA. */
-    /* TODO: VA is available when calling this function. */
-}
-
 /* Loads a segment starting at offset OFS in FILE at address
  * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
  * memory are initialized, as follows:
@@ -627,37 +623,27 @@ static bool load_segment(struct file* file,
     ASSERT(pg_ofs(upage) == 0);
     ASSERT(ofs % PGSIZE == 0);
 
-    while (read_bytes > 0 || zero_bytes > 0)
-    {
-        /* Do calculate how to fill this page.
-         * We will read PAGE_READ_BYTES bytes from FILE
-         * and zero the final PAGE_ZERO_BYTES bytes. */
-        size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-        size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-        /* TODO: Set up aux to pass information to the lazy_load_segment. */
-        void* aux = NULL;
-        if (!vm_alloc_page_with_initializer(VM_ANON, upage, writable,
-                                            lazy_load_segment, aux))
-            return false;
-
-        /* Advance. */
-        read_bytes -= page_read_bytes;
-        zero_bytes -= page_zero_bytes;
-        upage += PGSIZE;
-    }
-    return true;
+    /* The pages are loaded from the VMA as they are first
+     * touched. */
+    return vma_map(&thread_current()->spt, upage, read_bytes + zero_bytes,
+                   writable, VM_ANON, read_bytes > 0 ? file : NULL, ofs,
+                   read_bytes) != NULL;
 }
 
 /* Create a PAGE of stack at the USER_STACK. Return true on success. */
 static bool setup_stack(struct intr_frame* if_) {
     bool success = false;
     void* stack_bottom = (void*)(((uint8_t*)USER_STACK) - PGSIZE);
+    struct vma* stack;
 
-    /* TODO: Map the stack on stack_bottom and claim the page immediately.
-     * TODO: If success, set the rsp accordingly.
-     * TODO: You should mark the page is stack. */
-    /* TODO: Your code goes here */
+    stack = vma_map(&thread_current()->spt, stack_bottom, PGSIZE, true,
+                    VM_ANON, NULL, 0, 0);
+    if (stack != NULL && vma_alloc_page(stack, stack_bottom, true) &&
+        vm_claim_page(stack_bottom))
+    {
+        if_->rsp = USER_STACK;
+        success = true;
+    }
 
     return success;
 }
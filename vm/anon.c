@@ -1,7 +1,10 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
-#include "devices/disk.h"
 #include "vm/vm.h"
+#include <bitmap.h>
+#include "devices/disk.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk* swap_disk;
@@ -17,10 +20,41 @@ static const struct page_operations anon_ops = {
     .type = VM_ANON,
 };
 
+/* Swap space.
+
+   The swap disk is divided into slots of SLOT_SECTORS sectors,
+   one page each; swap_slots has a bit set for each slot in use.
+   A page goes to or comes from its slot in a single multi-sector
+   transfer.
+
+   Slots are handed out in order from a cluster, a run of
+   CLUSTER_SLOTS slots that were all free when it was chosen, so
+   that pages evicted one after another, which tend to be
+   neighbors in memory and to be faulted back in together, land
+   next to each other on disk.  Each new cluster is the lowest
+   free run on the disk, which keeps swap packed toward the start
+   of the disk and seeks short.  When there is no free run that
+   long, any free slot will do, again lowest first.  Searches
+   start at free_hint, below which every slot is in use, so that
+   they do not rescan the full slots at the start of the disk. */
+#define SLOT_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+#define CLUSTER_SLOTS 16
+
+static struct bitmap* swap_slots;
+static size_t cluster_next;   /* Next slot to hand out from the cluster. */
+static size_t cluster_end;    /* End of the cluster. */
+static size_t free_hint;      /* No slot below this one is free. */
+static struct lock swap_lock; /* Protects all of the above. */
+
 /* Initialize the data for anonymous pages */
 void vm_anon_init(void) {
-    /* TODO: Set up the swap_disk. */
-    swap_disk = NULL;
+    swap_disk = disk_get(1, 1);
+    lock_init(&swap_lock);
+    lock_set_name(&swap_lock, "swap");
+    if (swap_disk == NULL) return;
+
+    swap_slots = bitmap_create(disk_size(swap_disk) / SLOT_SECTORS);
+    if (swap_slots == NULL) PANIC("vm_anon_init: out of memory");
 }
 
 /* Initialize the file mapping */
@@ -29,19 +63,83 @@ bool anon_initializer(struct page* page, enum vm_type type, void* kva) {
     page->operations = &anon_ops;
 
     struct anon_page* anon_page = &page->anon;
+    anon_page->slot = SWAP_SLOT_NONE;
+    return true;
+}
+
+/* Returns a free swap slot, marked in use, or BITMAP_ERROR if
+   swap is full. */
+static size_t alloc_slot(void) {
+    size_t slot;
+
+    lock_acquire(&swap_lock);
+    if (cluster_next < cluster_end && !bitmap_test(swap_slots, cluster_next))
+        slot = cluster_next;
+    else
+    {
+        slot = bitmap_scan(swap_slots, free_hint, CLUSTER_SLOTS, false);
+        if (slot != BITMAP_ERROR)
+            cluster_end = slot + CLUSTER_SLOTS;
+        else
+        {
+            slot = bitmap_scan(swap_slots, free_hint, 1, false);
+            cluster_end = 0;
+        }
+    }
+    if (slot != BITMAP_ERROR)
+    {
+        bitmap_mark(swap_slots, slot);
+        cluster_next = slot + 1;
+        if (slot == free_hint) free_hint = slot + 1;
+    }
+    lock_release(&swap_lock);
+    return slot;
+}
+
+/* Marks SLOT free. */
+static void free_slot(size_t slot) {
+    lock_acquire(&swap_lock);
+    bitmap_reset(swap_slots, slot);
+    if (slot < free_hint) free_hint = slot;
+    lock_release(&swap_lock);
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool anon_swap_in(struct page* page, void* kva) {
     struct anon_page* anon_page = &page->anon;
+
+    ASSERT(anon_page->slot != SWAP_SLOT_NONE);
+
+    disk_read_multiple(swap_disk, anon_page->slot * SLOT_SECTORS, kva,
+                       SLOT_SECTORS);
+    free_slot(anon_page->slot);
+    anon_page->slot = SWAP_SLOT_NONE;
+    return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool anon_swap_out(struct page* page) {
     struct anon_page* anon_page = &page->anon;
+    size_t slot;
+
+    if (swap_slots == NULL) return false;
+    slot = alloc_slot();
+    if (slot == BITMAP_ERROR) return false;
+
+    disk_write_multiple(swap_disk, slot * SLOT_SECTORS, page->frame->kva,
+                        SLOT_SECTORS);
+    anon_page->slot = slot;
+    return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void anon_destroy(struct page* page) {
     struct anon_page* anon_page = &page->anon;
+
+    vm_free_frame(page, NULL);
+    if (anon_page->slot != SWAP_SLOT_NONE)
+    {
+        free_slot(anon_page->slot);
+        anon_page->slot = SWAP_SLOT_NONE;
+    }
 }
@@ -1,6 +1,9 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
 #include "vm/vm.h"
+#include <string.h>
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
 
 static bool file_backed_swap_in(struct page* page, void* kva);
 static bool file_backed_swap_out(struct page* page);
@@ -22,22 +25,55 @@ bool file_backed_initializer(struct page* page, enum vm_type type, void* kva) {
     /* Set up the handler */
     page->operations = &file_ops;
 
+    /* vma_load_page() fills in the rest. */
     struct file_page* file_page = &page->file;
+    file_page->file = NULL;
+    return true;
 }
 
 /* Swap in the page by read contents from the file. */
 static bool file_backed_swap_in(struct page* page, void* kva) {
-    struct file_page* file_page UNUSED = &page->file;
+    struct file_page* file_page = &page->file;
+
+    if (file_page->read_bytes > 0 &&
+        file_read_at(file_page->file, kva, file_page->read_bytes,
+                     file_page->offset) != (off_t)file_page->read_bytes)
+        return false;
+    memset((uint8_t*)kva + file_page->read_bytes, 0,
+           PGSIZE - file_page->read_bytes);
+    return true;
 }
 
 /* Swap out the page by writeback contents to the file. */
 static bool file_backed_swap_out(struct page* page) {
-    struct file_page* file_page UNUSED = &page->file;
+    file_backed_writeback(page);
+    return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void file_backed_destroy(struct page* page) {
-    struct file_page* file_page UNUSED = &page->file;
+    if (vm_pin_page(page))
+    {
+        file_backed_writeback(page);
+        vm_free_frame(page, NULL);
+    }
+}
+
+/* Writes PAGE, which must be in a frame that is pinned or being
+ * evicted, back to its file if the process has modified it. */
+void file_backed_writeback(struct page* page) {
+    struct file_page* file_page = &page->file;
+    uint64_t* pml4;
+
+    ASSERT(page->frame != NULL);
+
+    pml4 = page->frame->owner->pml4;
+    if (file_page->read_bytes > 0 && pml4_is_dirty(pml4, page->va))
+    {
+        file_write_at(file_page->file, page->frame->kva, file_page->read_bytes,
+                      file_page->offset);
+        pml4_set_dirty(pml4, page->va, false);
+    }
 }
 
 /* Do the mmap */
@@ -45,7 +81,28 @@ void* do_mmap(void* addr,
               size_t length,
               int writable,
               struct file* file,
-              off_t offset) {}
+              off_t offset) {
+    off_t file_len;
+    size_t read_bytes = 0;
+
+    if (file == NULL || offset < 0 || offset % PGSIZE != 0) return NULL;
+
+    file_len = file_length(file);
+    if (offset < file_len)
+        read_bytes = (size_t)(file_len - offset) < length
+                         ? (size_t)(file_len - offset)
+                         : length;
+    if (vma_map(&thread_current()->spt, addr, length, writable, VM_FILE, file,
+                offset, read_bytes) == NULL)
+        return NULL;
+    return addr;
+}
 
 /* Do the munmap */
-void do_munmap(void* addr) {}
+void do_munmap(void* addr) {
+    struct supplemental_page_table* spt = &thread_current()->spt;
+    struct vma* vma = vma_find(&spt->vmas, addr);
+
+    if (vma != NULL && vma->start == addr && vma->type == VM_FILE)
+        vma_unmap(spt, vma);
+}
@@ -8,8 +8,8 @@
  * function.
  * */
 
-#include "vm/uninit.h"
 #include "vm/vm.h"
+#include "vm/uninit.h"
 
 static bool uninit_initialize(struct page* page, void* kva);
 static void uninit_destroy(struct page* page);
@@ -1,12 +1,111 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
 #include "vm/vm.h"
+#include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/slab.h"
+#include "threads/smp.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/inspect.h"
 
+/* Supplemental page table.
+
+   The table is a radix tree keyed by user virtual page number,
+   shaped like the x86-64 page tables: SPT_LEVELS levels of
+   512-entry nodes, each one page, indexed by the same 9-bit
+   slices of the address as the PML4, page directory pointer
+   table, page directory and page table.  The leaves hold
+   struct page pointers.
+
+   A missing subtree is not a null pointer but the shared empty
+   node for its level, below, whose entries all point to the
+   empty node one level down (or are null, at the bottom).  A
+   lookup is therefore SPT_LEVELS loads with no tests; only
+   insertion and iteration compare against the empty nodes,
+   which lets iteration skip empty subtrees.  Nodes are freed
+   only when the whole table is killed. */
+
+#define SPT_FANOUT (PGSIZE / sizeof(void*)) /* Entries per node. */
+
+/* Shared empty node for each level.  Never written after
+   vm_init(). */
+static void* empty_nodes[SPT_LEVELS][SPT_FANOUT]
+    __attribute__((aligned(PGSIZE)));
+
+static void spt_init_empty_nodes(void);
+
+/* Frame table.
+
+   Every frame that holds a user page is on frame_table.  When
+   the user pool runs dry, vm_get_victim() picks a frame to evict
+   by sweeping a CLOCK hand around the table, treating it as a
+   ring.  It is the "enhanced second chance" variant: each frame
+   is classed by the accessed and dirty bits of the page it
+   holds, and the hand looks for a frame that is neither accessed
+   nor dirty first, then for one that is dirty but not accessed,
+   clearing accessed bits as it goes, and so on, so that a clean
+   page, which costs no write to evict, goes before a dirty one
+   that has been used just as recently.
+
+   CLOCK gives every page the same second chance, so a large
+   sequential scan of a mapped file, each page touched once,
+   pushes out a working set that is touched over and over.  The
+   "-mglru" option selects a multi-generational LRU instead,
+   which resists such scans.  Frames are sorted into GEN_CNT
+   generations, from min_seq, the oldest, to max_seq, the
+   youngest, and victims come from the oldest.  An anonymous
+   page enters the youngest generation, but a file page enters
+   the oldest, where a single access only moves it up one
+   generation; it takes a second access to reach the youngest.
+   Whenever the youngest generation has grown to its share of
+   the frames, a new, empty generation is started, if there is
+   room, so that the generations record roughly when each page
+   was last found accessed.
+
+   A pinned frame is never evicted.  A frame is pinned while its
+   page is being loaded into it and while the kernel works on
+   its contents through its kernel virtual address; see
+   vm_pin_page().
+
+   A page's frame link is only changed with frame_lock held.  The
+   victim's page keeps its frame while it is written out, which
+   happens without frame_lock, but is marked as evicting; anything
+   that would use or replace the page's frame first waits on
+   eviction_done until the write-out is over. */
+
+/* If false (default), evict with CLOCK.
+   If true, evict with the multi-generational LRU.
+   Controlled by kernel command-line option "-mglru". */
+bool vm_mglru;
+
+static size_t frame_cnt;       /* Number of frames in the frame table. */
+static struct lock frame_lock; /* Protects the frame table. */
+static struct condition eviction_done; /* A page is no longer evicting. */
+static struct kmem_cache* frame_cache;
+
+/* CLOCK. */
+static struct list frame_table;
+static struct list_elem* clock_hand; /* Next frame to look at. */
+
+/* Multi-generational LRU. */
+#define GEN_CNT 4                       /* Most generations at once. */
+static struct list gens[GEN_CNT];       /* Generation SEQ is gens[SEQ % GEN_CNT]. */
+static size_t gen_frame_cnt[GEN_CNT];   /* Frames in each of gens[]. */
+static unsigned long min_seq, max_seq;  /* Oldest and youngest generation. */
+
+/* Eviction statistics. */
+static long long evict_cnt;       /* Frames evicted. */
+static long long evict_dirty_cnt; /* ...of which held a dirty page. */
+static long long scan_cnt;        /* Frames looked at for eviction. */
+
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
 void vm_init(void) {
+    int i;
+
     vm_anon_init();
     vm_file_init();
 #ifdef EFILESYS /* For project 4 */
@@ -14,7 +113,24 @@ void vm_init(void) {
 #endif
     register_inspect_intr();
     /* DO NOT MODIFY UPPER LINES. */
-    /* TODO: Your code goes here. */
+    spt_init_empty_nodes();
+    vma_init();
+
+    list_init(&frame_table);
+    clock_hand = list_end(&frame_table);
+    for (i = 0; i < GEN_CNT; i++) list_init(&gens[i]);
+    min_seq = 0;
+    max_seq = 1;
+    lock_init(&frame_lock);
+    lock_set_name(&frame_lock, "frame table");
+    cond_init(&eviction_done);
+    frame_cache = kmem_cache_create("frame", sizeof(struct frame), 0, NULL);
+}
+
+/* Prints eviction statistics. */
+void vm_print_stats(void) {
+    printf("VM: %lld frames evicted, %lld dirty, %lld scanned (%s)\n",
+           evict_cnt, evict_dirty_cnt, scan_cnt, vm_mglru ? "mglru" : "clock");
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -32,6 +148,7 @@ enum vm_type page_get_type(struct page* page) {
 /* Helpers */
 static struct frame* vm_get_victim(void);
 static bool vm_do_claim_page(struct page* page);
+static struct frame* vm_claim_pinned(struct page* page, struct thread* owner);
 static struct frame* vm_evict_frame(void);
 
 /* Create the pending page object with initializer. If you want to create a
@@ -49,63 +166,405 @@ bool vm_alloc_page_with_initializer(enum vm_type type,
     /* Check wheter the upage is already occupied or not. */
     if (spt_find_page(spt, upage) == NULL)
     {
-        /* TODO: Create the page, fetch the initialier according to the VM type,
-         * TODO: and then create "uninit" page struct by calling uninit_new. You
-         * TODO: should modify the field after calling the uninit_new. */
-
-        /* TODO: Insert the page into the spt. */
+        bool (*initializer)(struct page*, enum vm_type, void*);
+        struct page* page;
+
+        switch (VM_TYPE(type))
+        {
+            case VM_ANON: initializer = anon_initializer; break;
+            case VM_FILE: initializer = file_backed_initializer; break;
+            default: goto err;
+        }
+
+        page = malloc(sizeof *page);
+        if (page == NULL) goto err;
+        uninit_new(page, upage, init, type, aux, initializer);
+        page->writable = writable;
+
+        if (!spt_insert_page(spt, page))
+        {
+            free(page);
+            goto err;
+        }
+        return true;
     }
 err:
     return false;
 }
 
+/* Returns the index into a node at LEVEL of the supplemental
+   page table for virtual address VA. */
+static inline size_t spt_index(const void* va, int level) {
+    int shift = PGBITS + 9 * (SPT_LEVELS - 1 - level);
+    return ((uint64_t)va >> shift) & (SPT_FANOUT - 1);
+}
+
+/* Makes each empty node point to the one below it. */
+static void spt_init_empty_nodes(void) {
+    int level;
+    size_t i;
+
+    for (level = 0; level < SPT_LEVELS - 1; level++)
+        for (i = 0; i < SPT_FANOUT; i++)
+            empty_nodes[level][i] = empty_nodes[level + 1];
+}
+
+/* Returns a new node for LEVEL with no pages under it, or a null
+   pointer if memory is short. */
+static void** spt_new_node(int level) {
+    void** node = palloc_get_page(0);
+    if (node != NULL) memcpy(node, empty_nodes[level], PGSIZE);
+    return node;
+}
+
 /* Find VA from spt and return page. On error, return NULL. */
-struct page* spt_find_page(struct supplemental_page_table* spt UNUSED,
-                           void* va UNUSED) {
-    struct page* page = NULL;
-    /* TODO: Fill this function. */
+struct page* spt_find_page(struct supplemental_page_table* spt, void* va) {
+    void** node = spt->root;
+    int level;
+
+    for (level = 0; level < SPT_LEVELS - 1; level++)
+        node = node[spt_index(va, level)];
+    return node[spt_index(va, SPT_LEVELS - 1)];
+}
 
-    return page;
+/* Returns the leaf slot for VA in SPT, creating the nodes on the
+   way to it if CREATE is true.  Returns a null pointer if CREATE
+   is false and there is no leaf node for VA, or if memory is
+   short. */
+static void** spt_slot(struct supplemental_page_table* spt,
+                       const void* va,
+                       bool create) {
+    void*** slot = (void***)&spt->root;
+    int level;
+
+    for (level = 0; level < SPT_LEVELS; level++)
+    {
+        if (*slot == empty_nodes[level])
+        {
+            if (!create || (*slot = spt_new_node(level)) == NULL)
+            {
+                *slot = empty_nodes[level];
+                return NULL;
+            }
+        }
+        if (level < SPT_LEVELS - 1) slot = (void***)&(*slot)[spt_index(va, level)];
+    }
+    return &(*slot)[spt_index(va, SPT_LEVELS - 1)];
 }
 
 /* Insert PAGE into spt with validation. */
-bool spt_insert_page(struct supplemental_page_table* spt UNUSED,
-                     struct page* page UNUSED) {
-    int succ = false;
-    /* TODO: Fill this function. */
+bool spt_insert_page(struct supplemental_page_table* spt, struct page* page) {
+    void** slot;
+
+    ASSERT(pg_ofs(page->va) == 0);
+    ASSERT(is_user_vaddr(page->va));
+
+    slot = spt_slot(spt, page->va, true);
+    if (slot == NULL || *slot != NULL) return false;
 
-    return succ;
+    *slot = page;
+    spt->page_cnt++;
+    return true;
 }
 
 void spt_remove_page(struct supplemental_page_table* spt, struct page* page) {
+    void** slot = spt_slot(spt, page->va, false);
+
+    ASSERT(slot != NULL && *slot == page);
+    *slot = NULL;
+    spt->page_cnt--;
     vm_dealloc_page(page);
+}
+
+/* Calls FUNC for each page in NODE, at LEVEL, whose subtree
+   starts at virtual address BASE, that lies in [START, END), in
+   order of virtual address, skipping empty subtrees and those
+   outside the range.  Stops and returns false as soon as FUNC
+   returns false. */
+static bool spt_walk(void** node,
+                     int level,
+                     uintptr_t base,
+                     uintptr_t start,
+                     uintptr_t end,
+                     spt_for_each_func* func,
+                     void* aux) {
+    uintptr_t span = (uintptr_t)1 << (PGBITS + 9 * (SPT_LEVELS - 1 - level));
+    size_t i;
+
+    if (node == empty_nodes[level]) return true;
+    for (i = 0; i < SPT_FANOUT; i++)
+    {
+        uintptr_t lo = base + i * span;
+
+        if (lo >= end) break;
+        if (lo + span <= start) continue;
+        if (level == SPT_LEVELS - 1)
+        {
+            if (node[i] != NULL && !func(node[i], aux)) return false;
+        }
+        else if (!spt_walk(node[i], level + 1, lo, start, end, func, aux))
+            return false;
+    }
     return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Calls FUNC for each page in SPT, in order of virtual address,
+   passing AUX along.  Stops and returns false as soon as FUNC
+   returns false; otherwise, returns true.  FUNC must not insert
+   pages into or remove pages from SPT. */
+bool spt_for_each(struct supplemental_page_table* spt,
+                  spt_for_each_func* func,
+                  void* aux) {
+    return spt_walk(spt->root, 0, 0, 0, UINTPTR_MAX, func, aux);
+}
+
+/* Like spt_for_each(), but only for the pages in SPT from START
+   up to but not including END, so that the cost follows the
+   pages that exist rather than the size of the range.  FUNC may
+   remove the page it is passed, but no other, and must not
+   insert pages. */
+bool spt_for_each_range(struct supplemental_page_table* spt,
+                        void* start,
+                        void* end,
+                        spt_for_each_func* func,
+                        void* aux) {
+    return spt_walk(spt->root, 0, 0, (uintptr_t)start, (uintptr_t)end, func,
+                    aux);
+}
+
+/* Returns the frame under the CLOCK hand and advances the hand,
+   wrapping around at the end of the frame table, which must not
+   be empty. */
+static struct frame* clock_advance(void) {
+    struct frame* frame;
+
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    if (clock_hand == list_end(&frame_table))
+        clock_hand = list_begin(&frame_table);
+    frame = list_entry(clock_hand, struct frame, elem);
+    clock_hand = list_next(clock_hand);
+    scan_cnt++;
+    return frame;
+}
+
+/* Get the struct frame, that will be evicted, by CLOCK.
+   Returns a null pointer if every frame is pinned. */
+static struct frame* clock_get_victim(void) {
+    int round;
+    size_t i;
+
+    /* Even rounds look for a page that is neither accessed nor
+       dirty, odd rounds for one that is dirty but not accessed,
+       clearing the accessed bits of the rest.  By the third
+       round every accessed bit has been cleared once, so unless
+       the pages are in use right now the fourth round at the
+       latest finds a victim. */
+    for (round = 0; round < 4; round++)
+        for (i = 0; i < frame_cnt; i++)
+        {
+            struct frame* frame = clock_advance();
+            uint64_t* pml4 = frame->owner->pml4;
+            void* va;
+
+            if (frame->pinned) continue;
+            va = frame->page->va;
+            if (pml4_is_accessed(pml4, va))
+            {
+                if (round % 2 == 1) pml4_set_accessed(pml4, va, false);
+            }
+            else if (pml4_is_dirty(pml4, va) == (round % 2 == 1))
+                return frame;
+        }
+
+    /* The pages were all touched again as soon as we cleared
+       them.  Take the first one that is not pinned. */
+    for (i = 0; i < frame_cnt; i++)
+    {
+        struct frame* frame = clock_advance();
+        if (!frame->pinned) return frame;
+    }
+    return NULL;
+}
+
+/* Adds FRAME to generation SEQ. */
+static void gen_add(struct frame* frame, unsigned long seq) {
+    ASSERT(seq >= min_seq && seq <= max_seq);
+
+    frame->gen = seq;
+    list_push_back(&gens[seq % GEN_CNT], &frame->elem);
+    gen_frame_cnt[seq % GEN_CNT]++;
+}
+
+/* Removes FRAME from its generation. */
+static void gen_remove(struct frame* frame) {
+    list_remove(&frame->elem);
+    gen_frame_cnt[frame->gen % GEN_CNT]--;
+}
+
+/* Moves FRAME to generation SEQ.  Starts a new youngest
+   generation if SEQ is the youngest and has grown to its share
+   of the frames, and there is room for another. */
+static void gen_move(struct frame* frame, unsigned long seq) {
+    gen_remove(frame);
+    gen_add(frame, seq);
+    if (seq == max_seq && max_seq - min_seq + 1 < GEN_CNT &&
+        gen_frame_cnt[max_seq % GEN_CNT] > frame_cnt / GEN_CNT)
+        max_seq++;
+}
+
+/* Get the struct frame, that will be evicted, by the
+   multi-generational LRU.  Returns a null pointer if every frame
+   is pinned. */
+static struct frame* mglru_get_victim(void) {
+    size_t step;
+
+    /* Each step either retires an empty generation or moves a
+       frame into a younger one, so a frame can be passed over
+       only so many times before there must be a victim, unless
+       they are all pinned. */
+    for (step = 0; step < 2 * GEN_CNT * (frame_cnt + 1); step++)
+    {
+        struct list* oldest = &gens[min_seq % GEN_CNT];
+        struct frame* frame;
+        uint64_t* pml4;
+
+        /* Retire the oldest generation once it is empty, always
+           keeping two. */
+        if (list_empty(oldest))
+        {
+            min_seq++;
+            if (min_seq == max_seq) max_seq++;
+            continue;
+        }
+
+        scan_cnt++;
+        frame = list_entry(list_front(oldest), struct frame, elem);
+        pml4 = frame->owner->pml4;
+        if (frame->pinned)
+            gen_move(frame, min_seq + 1);
+        else if (pml4_is_accessed(pml4, frame->page->va))
+        {
+            pml4_set_accessed(pml4, frame->page->va, false);
+            gen_move(frame, frame->promoted ? max_seq : min_seq + 1);
+            frame->promoted = true;
+        }
+        else
+            return frame;
+    }
+    return NULL;
+}
+
+/* Get the struct frame, that will be evicted.
+   Returns a null pointer if every frame is pinned. */
 static struct frame* vm_get_victim(void) {
-    struct frame* victim = NULL;
-    /* TODO: The policy for eviction is up to you. */
+    ASSERT(lock_held_by_current_thread(&frame_lock));
 
-    return victim;
+    return vm_mglru ? mglru_get_victim() : clock_get_victim();
+}
+
+/* Adds FRAME, which holds a page, to the frame table. */
+static void frame_table_insert(struct frame* frame) {
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    if (vm_mglru)
+    {
+        /* Only a second access promotes a file page to the
+           youngest generation, so that streaming through a file
+           does not push out pages in active use. */
+        frame->promoted = page_get_type(frame->page) != VM_FILE;
+        gen_add(frame, frame->promoted ? max_seq : min_seq);
+    }
+    else
+        list_push_back(&frame_table, &frame->elem);
+    frame_cnt++;
+}
+
+/* Removes FRAME from the frame table, moving the CLOCK hand past
+   it if need be. */
+static void frame_table_remove(struct frame* frame) {
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    if (vm_mglru)
+        gen_remove(frame);
+    else
+    {
+        if (clock_hand == &frame->elem) clock_hand = list_next(clock_hand);
+        list_remove(&frame->elem);
+    }
+    frame_cnt--;
+}
+
+/* Waits until PAGE is not being evicted. */
+static void wait_for_eviction(struct page* page) {
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    while (page->evicting) cond_wait(&eviction_done, &frame_lock);
 }
 
 /* Evict one page and return the corresponding frame.
  * Return NULL on error.*/
 static struct frame* vm_evict_frame(void) {
-    struct frame* victim UNUSED = vm_get_victim();
-    /* TODO: swap out the victim and return the evicted frame. */
+    struct frame* victim;
+    struct page* page;
 
-    return NULL;
+    lock_acquire(&frame_lock);
+    victim = vm_get_victim();
+    if (victim == NULL)
+    {
+        lock_release(&frame_lock);
+        return NULL;
+    }
+    page = victim->page;
+    frame_table_remove(victim);
+    page->evicting = true;
+
+    /* Unmap the page before writing it out, so that its owner
+       cannot modify it behind our back. */
+    pml4_clear_page(victim->owner->pml4, page->va);
+    evict_cnt++;
+    if (pml4_is_dirty(victim->owner->pml4, page->va)) evict_dirty_cnt++;
+    lock_release(&frame_lock);
+
+    /* The owner may be running on another CPU with the mapping in
+       its TLB. */
+    if (victim->owner != thread_current() && cpu_cnt > 1) smp_flush_tlb();
+    if (!swap_out(page)) PANIC("vm_evict_frame: cannot swap out page");
+
+    lock_acquire(&frame_lock);
+    page->frame = NULL;
+    page->evicting = false;
+    cond_broadcast(&eviction_done, &frame_lock);
+    lock_release(&frame_lock);
+
+    victim->page = NULL;
+    return victim;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
  * and return it. This always return valid address. That is, if the user pool
  * memory is full, this function evicts the frame to get the available memory
- * space.*/
-static struct frame* vm_get_frame(void) {
+ * space.
+ * The frame is pinned, on behalf of OWNER; vm_claim_pinned() adds it
+ * to the frame table. */
+static struct frame* vm_get_frame(struct thread* owner) {
     struct frame* frame = NULL;
-    /* TODO: Fill this function. */
+    void* kva = palloc_get_page(PAL_USER);
+
+    if (kva == NULL)
+    {
+        frame = vm_evict_frame();
+        if (frame == NULL) PANIC("vm_get_frame: every frame is pinned");
+    }
+    else
+    {
+        frame = kmem_cache_alloc(frame_cache);
+        if (frame == NULL) PANIC("vm_get_frame: out of memory");
+        frame->kva = kva;
+        frame->page = NULL;
+    }
+    frame->owner = owner;
+    frame->pinned = true;
 
     ASSERT(frame != NULL);
     ASSERT(frame->page == NULL);
@@ -120,14 +579,24 @@ static bool vm_handle_wp(struct page* page UNUSED) {}
 
 /* Return true on success */
 bool vm_try_handle_fault(struct intr_frame* f UNUSED,
-                         void* addr UNUSED,
+                         void* addr,
                          bool user UNUSED,
-                         bool write UNUSED,
-                         bool not_present UNUSED) {
-    struct supplemental_page_table* spt UNUSED = &thread_current()->spt;
-    struct page* page = NULL;
-    /* TODO: Validate the fault */
-    /* TODO: Your code goes here */
+                         bool write,
+                         bool not_present) {
+    struct supplemental_page_table* spt = &thread_current()->spt;
+    struct page* page;
+
+    if (addr == NULL || !is_user_vaddr(addr) || !not_present) return false;
+
+    /* Pages in a VMA are created on first access. */
+    page = spt_find_page(spt, addr);
+    if (page == NULL)
+    {
+        struct vma* vma = vma_find(&spt->vmas, addr);
+        if (vma == NULL || !vma_alloc_page(vma, addr, true)) return false;
+        page = spt_find_page(spt, addr);
+    }
+    if (write && !page->writable) return false;
 
     return vm_do_claim_page(page);
 }
@@ -139,36 +608,204 @@ void vm_dealloc_page(struct page* page) {
     free(page);
 }
 
+/* Pins PAGE's frame, if it has one, so that it is not evicted
+ * until vm_unpin_page() or vm_free_frame().  Returns true if
+ * PAGE has a frame, false if it has none, for example because it
+ * was just evicted.  Waits for an eviction in progress. */
+bool vm_pin_page(struct page* page) {
+    bool pinned;
+
+    lock_acquire(&frame_lock);
+    wait_for_eviction(page);
+    pinned = page->frame != NULL;
+    if (pinned) page->frame->pinned = true;
+    lock_release(&frame_lock);
+    return pinned;
+}
+
+/* Unpins PAGE's frame. */
+void vm_unpin_page(struct page* page) {
+    ASSERT(page->frame != NULL && page->frame->pinned);
+
+    page->frame->pinned = false;
+}
+
+/* Unmaps PAGE from the process that owns it and frees its frame,
+ * if it has one.  If TLB is nonnull, leaves the TLB flush and the
+ * freeing of the frame's page to it. */
+void vm_free_frame(struct page* page, struct mmu_gather* tlb) {
+    struct frame* frame;
+
+    lock_acquire(&frame_lock);
+    wait_for_eviction(page);
+    frame = page->frame;
+    if (frame != NULL) frame_table_remove(frame);
+    page->frame = NULL;
+    lock_release(&frame_lock);
+
+    if (frame == NULL) return;
+    if (tlb != NULL)
+    {
+        mmu_gather_clear_page(tlb, page->va);
+        mmu_gather_free_page(tlb, frame->kva);
+    }
+    else
+    {
+        pml4_clear_page(frame->owner->pml4, page->va);
+        palloc_free_page(frame->kva);
+    }
+    kmem_cache_free(frame_cache, frame);
+}
+
+/* Writes PAGE back, if it is file-backed, and frees its frame, if
+ * it has one, leaving the TLB flush to TLB.  PAGE itself stays in
+ * its supplemental page table. */
+void vm_unmap_page(struct page* page, struct mmu_gather* tlb) {
+    if (!vm_pin_page(page)) return;
+    if (page_get_type(page) == VM_FILE) file_backed_writeback(page);
+    vm_free_frame(page, tlb);
+}
+
 /* Claim the page that allocate on VA. */
-bool vm_claim_page(void* va UNUSED) {
-    struct page* page = NULL;
-    /* TODO: Fill this function */
+bool vm_claim_page(void* va) {
+    struct page* page = spt_find_page(&thread_current()->spt, va);
 
+    if (page == NULL) return false;
     return vm_do_claim_page(page);
 }
 
 /* Claim the PAGE and set up the mmu. */
 static bool vm_do_claim_page(struct page* page) {
-    struct frame* frame = vm_get_frame();
+    if (vm_claim_pinned(page, thread_current()) == NULL) return false;
+    vm_unpin_page(page);
+    return true;
+}
 
-    /* Set links */
+/* Loads PAGE into a new frame and maps it in OWNER's pml4.
+ * Returns the frame, still pinned, or a null pointer on failure. */
+static struct frame* vm_claim_pinned(struct page* page, struct thread* owner) {
+    struct frame* frame = vm_get_frame(owner);
+
+    /* Set links.  Until an eviction of PAGE is over, its contents
+       are not where swap_in() would look for them. */
+    lock_acquire(&frame_lock);
+    wait_for_eviction(page);
+    ASSERT(page->frame == NULL);
     frame->page = page;
     page->frame = frame;
+    frame_table_insert(frame);
+    lock_release(&frame_lock);
 
-    /* TODO: Insert page table entry to map page's VA to frame's PA. */
-
-    return swap_in(page, frame->kva);
+    if (!pml4_set_page(owner->pml4, page->va, frame->kva, page->writable) ||
+        !swap_in(page, frame->kva))
+    {
+        vm_free_frame(page, NULL);
+        return NULL;
+    }
+    return frame;
 }
 
 /* Initialize new supplemental page table */
-void supplemental_page_table_init(struct supplemental_page_table* spt UNUSED) {}
+void supplemental_page_table_init(struct supplemental_page_table* spt) {
+    spt->root = empty_nodes[0];
+    spt->page_cnt = 0;
+    vma_tree_init(&spt->vmas);
+}
+
+/* Where copy_page() copies to. */
+struct spt_copy {
+    struct supplemental_page_table* dst; /* The current process's. */
+    struct thread* parent;               /* Owner of the source pages. */
+};
+
+/* Adds a copy of SRC, a page of the parent process, to the
+   current process's supplemental page table in AUX, a struct
+   spt_copy, whose VMAs have already been copied.  A page in a
+   VMA that has not been loaded yet is left for the child to
+   create from its own VMA on first access; other pages that have
+   not been loaded yet are copied as is, sharing their AUX with
+   the parent.  A loaded page is loaded right away in the child
+   with the contents of the parent's frame, which is brought back
+   first if it has been evicted, and is not read from its VMA's
+   file. */
+static bool copy_page(struct page* src, void* aux) {
+    struct spt_copy* copy = aux;
+    struct vma* vma = vma_find(&copy->dst->vmas, src->va);
+    struct page* dst;
+    bool ok;
+
+    if (VM_TYPE(src->operations->type) == VM_UNINIT)
+    {
+        if (vma != NULL) return true;
+        return vm_alloc_page_with_initializer(src->uninit.type, src->va,
+                                              src->writable, src->uninit.init,
+                                              src->uninit.aux);
+    }
+
+    if (vma != NULL)
+        ok = vma_alloc_page(vma, src->va, false);
+    else
+        ok = vm_alloc_page(src->operations->type, src->va, src->writable);
+    if (!ok) return false;
+    dst = spt_find_page(copy->dst, src->va);
+
+    if (!vm_pin_page(src) && vm_claim_pinned(src, copy->parent) == NULL)
+        return false;
+    ok = vm_claim_pinned(dst, thread_current()) != NULL;
+    if (ok)
+    {
+        memcpy(dst->frame->kva, src->frame->kva, PGSIZE);
+        vm_unpin_page(dst);
+    }
+    vm_unpin_page(src);
+    return ok;
+}
 
 /* Copy supplemental page table from src to dst */
-bool supplemental_page_table_copy(struct supplemental_page_table* dst UNUSED,
-                                  struct supplemental_page_table* src UNUSED) {}
+bool supplemental_page_table_copy(struct supplemental_page_table* dst,
+                                  struct supplemental_page_table* src) {
+    struct spt_copy copy;
+
+    ASSERT(dst == &thread_current()->spt);
+
+    /* A thread's structure starts its page, like SRC's parent's. */
+    copy.dst = dst;
+    copy.parent = pg_round_down(src);
+    return vma_copy_all(dst, src) && spt_for_each(src, copy_page, &copy);
+}
+
+/* Frees NODE, at LEVEL of a supplemental page table, along with
+   its subtree and the pages in it.  Their frames are unmapped
+   through TLB, so that one flush covers them all. */
+static void spt_destroy_node(void** node, int level,
+                             struct mmu_gather* tlb) {
+    size_t i;
+
+    if (node == empty_nodes[level]) return;
+    for (i = 0; i < SPT_FANOUT; i++)
+        if (level == SPT_LEVELS - 1)
+        {
+            if (node[i] == NULL) continue;
+            vm_unmap_page(node[i], tlb);
+            vm_dealloc_page(node[i]);
+        }
+        else
+            spt_destroy_node(node[i], level + 1, tlb);
+    palloc_free_page(node);
+}
 
 /* Free the resource hold by the supplemental page table */
-void supplemental_page_table_kill(struct supplemental_page_table* spt UNUSED) {
-    /* TODO: Destroy all the supplemental_page_table hold by thread and
-     * TODO: writeback all the modified contents to the storage. */
+void supplemental_page_table_kill(struct supplemental_page_table* spt) {
+    struct mmu_gather tlb;
+
+    /* The pml4 is still active, so this cannot be a fullmm
+       gather. */
+    mmu_gather_init(&tlb, thread_current()->pml4, false);
+
+    /* Destroying a file-backed page writes it back through its
+       VMA's file, so the VMAs go last. */
+    spt_destroy_node(spt->root, 0, &tlb);
+    mmu_gather_finish(&tlb);
+    vma_destroy_all(spt);
+    supplemental_page_table_init(spt);
 }
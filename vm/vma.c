@@ -0,0 +1,353 @@
+/* vma.c: Virtual memory areas. */
+
+#include "vm/vm.h"
+#include <round.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/mmu.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
+
+/* A process describes its address space as a set of VMAs, one
+ * per ELF segment, stack and mmap region, instead of a struct
+ * page for every page up front.  The first fault on a page in a
+ * VMA creates its struct page, with vma_alloc_page(), and loads
+ * it from the VMA's file, if any, with vma_load_page().
+ *
+ * A process's VMAs never overlap.  They are kept in an interval
+ * tree: an AVL tree ordered by start address in which each node
+ * also records the greatest end address in its subtree.  Finding
+ * the VMA that covers an address, and finding any VMA that
+ * overlaps a range, both take O(log n) steps. */
+
+static struct kmem_cache* vma_cache;
+
+/* Initializes the VMA allocator. */
+void vma_init(void) {
+    vma_cache = kmem_cache_create("vma", sizeof(struct vma), 0, NULL);
+}
+
+/* Initializes TREE as empty. */
+void vma_tree_init(struct vma_tree* tree) { tree->root = NULL; }
+
+/* Interval tree. */
+
+/* Returns the height of the subtree at V. */
+static int height(const struct vma* v) { return v != NULL ? v->height : 0; }
+
+/* Recomputes V's height and max_end from its children. */
+static void update(struct vma* v) {
+    int lh = height(v->left), rh = height(v->right);
+
+    v->height = (lh > rh ? lh : rh) + 1;
+    v->max_end = v->end;
+    if (v->left != NULL && v->left->max_end > v->max_end)
+        v->max_end = v->left->max_end;
+    if (v->right != NULL && v->right->max_end > v->max_end)
+        v->max_end = v->right->max_end;
+}
+
+/* Rotates the subtree at V right and returns its new root. */
+static struct vma* rotate_right(struct vma* v) {
+    struct vma* l = v->left;
+
+    v->left = l->right;
+    l->right = v;
+    update(v);
+    update(l);
+    return l;
+}
+
+/* Rotates the subtree at V left and returns its new root. */
+static struct vma* rotate_left(struct vma* v) {
+    struct vma* r = v->right;
+
+    v->right = r->left;
+    r->left = v;
+    update(v);
+    update(r);
+    return r;
+}
+
+/* Restores the AVL balance of the subtree at V, whose children
+ * are balanced and differ in height by at most 2, and returns its
+ * new root. */
+static struct vma* rebalance(struct vma* v) {
+    int balance;
+
+    update(v);
+    balance = height(v->left) - height(v->right);
+    if (balance > 1)
+    {
+        if (height(v->left->left) < height(v->left->right))
+            v->left = rotate_left(v->left);
+        return rotate_right(v);
+    }
+    if (balance < -1)
+    {
+        if (height(v->right->right) < height(v->right->left))
+            v->right = rotate_right(v->right);
+        return rotate_left(v);
+    }
+    return v;
+}
+
+/* Inserts V into the subtree at ROOT and returns its new root. */
+static struct vma* insert_node(struct vma* root, struct vma* v) {
+    if (root == NULL)
+    {
+        v->left = v->right = NULL;
+        update(v);
+        return v;
+    }
+    if (v->start < root->start)
+        root->left = insert_node(root->left, v);
+    else
+        root->right = insert_node(root->right, v);
+    return rebalance(root);
+}
+
+/* Removes the leftmost node from the subtree at ROOT, stores it
+ * in *MIN, and returns the subtree's new root. */
+static struct vma* remove_min(struct vma* root, struct vma** min) {
+    if (root->left == NULL)
+    {
+        *min = root;
+        return root->right;
+    }
+    root->left = remove_min(root->left, min);
+    return rebalance(root);
+}
+
+/* Removes V from the subtree at ROOT and returns its new root. */
+static struct vma* remove_node(struct vma* root, struct vma* v) {
+    ASSERT(root != NULL);
+
+    if (v->start < root->start)
+        root->left = remove_node(root->left, v);
+    else if (v->start > root->start)
+        root->right = remove_node(root->right, v);
+    else
+    {
+        struct vma* min;
+
+        if (root->right == NULL) return root->left;
+        root->right = remove_min(root->right, &min);
+        min->left = root->left;
+        min->right = root->right;
+        root = min;
+    }
+    return rebalance(root);
+}
+
+/* Returns the VMA in TREE that contains VA, or a null pointer if
+ * there is none. */
+struct vma* vma_find(const struct vma_tree* tree, const void* va) {
+    struct vma* v = tree->root;
+
+    while (v != NULL)
+        if (va < v->start)
+            v = v->left;
+        else if (va >= v->end)
+            v = v->right;
+        else
+            return v;
+    return NULL;
+}
+
+/* Returns a VMA in TREE that overlaps the range from START to
+ * END, exclusive, or a null pointer if there is none.  If the
+ * left subtree reaches past START, then either it holds an
+ * overlapping VMA or no VMA to its right can overlap, so only one
+ * path is followed. */
+struct vma* vma_overlap(const struct vma_tree* tree,
+                        const void* start,
+                        const void* end) {
+    struct vma* v = tree->root;
+
+    while (v != NULL)
+        if (v->start < end && start < v->end)
+            return v;
+        else if (v->left != NULL && v->left->max_end > start)
+            v = v->left;
+        else
+            v = v->right;
+    return NULL;
+}
+
+/* Mapping and unmapping. */
+
+/* Adds a VMA of LENGTH bytes, rounded up to whole pages, at
+ * START in SPT.  Its pages are writable if WRITABLE is true and
+ * have type TYPE.  If FILE is nonnull, the first READ_BYTES bytes
+ * are read from FILE starting at OFFSET, and the VMA keeps its
+ * own handle to FILE.  The rest of the pages are zeroed.
+ *
+ * Returns the new VMA, or a null pointer if START is not page
+ * aligned, the range is empty or not in user space, it overlaps
+ * another VMA, or memory is short. */
+struct vma* vma_map(struct supplemental_page_table* spt,
+                    void* start,
+                    size_t length,
+                    bool writable,
+                    enum vm_type type,
+                    struct file* file,
+                    off_t offset,
+                    size_t read_bytes) {
+    void* end = (uint8_t*)start + ROUND_UP(length, PGSIZE);
+    struct vma* v;
+
+    ASSERT(read_bytes <= length);
+
+    if (start == NULL || pg_ofs(start) != 0 || length == 0 ||
+        end <= start || !is_user_vaddr((uint8_t*)end - 1) ||
+        vma_overlap(&spt->vmas, start, end) != NULL)
+        return NULL;
+
+    v = kmem_cache_alloc(vma_cache);
+    if (v == NULL) return NULL;
+    v->start = start;
+    v->end = end;
+    v->writable = writable;
+    v->type = type;
+    v->file = NULL;
+    v->offset = offset;
+    v->read_bytes = read_bytes;
+    if (file != NULL && (v->file = file_reopen(file)) == NULL)
+    {
+        kmem_cache_free(vma_cache, v);
+        return NULL;
+    }
+
+    spt->vmas.root = insert_node(spt->vmas.root, v);
+    return v;
+}
+
+/* Where unmap_page() unmaps from. */
+struct spt_unmap {
+    struct supplemental_page_table* spt; /* The current process's. */
+    struct mmu_gather tlb;               /* Frames to flush. */
+};
+
+/* Writes back PAGE and removes it from the supplemental page
+ * table in AUX, a struct spt_unmap. */
+static bool unmap_page(struct page* page, void* aux) {
+    struct spt_unmap* unmap = aux;
+
+    vm_unmap_page(page, &unmap->tlb);
+    spt_remove_page(unmap->spt, page);
+    return true;
+}
+
+/* Writes back and removes the pages of V from SPT, the current
+ * process's, flushing the TLB for them all at once, then frees
+ * V.  Only the pages that exist are visited, so a large, sparse
+ * V is cheap to unmap. */
+void vma_unmap(struct supplemental_page_table* spt, struct vma* v) {
+    struct spt_unmap unmap;
+
+    ASSERT(spt == &thread_current()->spt);
+
+    unmap.spt = spt;
+    mmu_gather_init(&unmap.tlb, thread_current()->pml4, false);
+    spt_for_each_range(spt, v->start, v->end, unmap_page, &unmap);
+    mmu_gather_finish(&unmap.tlb);
+
+    spt->vmas.root = remove_node(spt->vmas.root, v);
+    file_close(v->file);
+    kmem_cache_free(vma_cache, v);
+}
+
+/* Pages. */
+
+/* Returns the number of bytes of PAGE, in V, that come from V's
+ * file, and points a file-backed PAGE at them. */
+static size_t vma_attach_page(struct page* page, struct vma* v) {
+    size_t ofs = (uint8_t*)page->va - (uint8_t*)v->start;
+    size_t read_bytes = 0;
+
+    if (ofs < v->read_bytes)
+        read_bytes = v->read_bytes - ofs < PGSIZE ? v->read_bytes - ofs : PGSIZE;
+    if (page_get_type(page) == VM_FILE)
+    {
+        page->file.file = v->file;
+        page->file.offset = v->offset + ofs;
+        page->file.read_bytes = read_bytes;
+    }
+    return read_bytes;
+}
+
+/* Loads PAGE, in the VMA AUX, from the VMA's file and zeroes
+ * the rest of it. */
+static bool vma_load_page(struct page* page, void* aux) {
+    struct vma* v = aux;
+    uint8_t* kva = page->frame->kva;
+    size_t ofs = (uint8_t*)page->va - (uint8_t*)v->start;
+    size_t read_bytes = vma_attach_page(page, v);
+
+    if (read_bytes > 0 &&
+        file_read_at(v->file, kva, read_bytes, v->offset + ofs) !=
+            (off_t)read_bytes)
+        return false;
+    memset(kva + read_bytes, 0, PGSIZE - read_bytes);
+    return true;
+}
+
+/* Sets up PAGE, in the VMA AUX, without touching its contents,
+ * which the caller fills in itself. */
+static bool vma_keep_page(struct page* page, void* aux) {
+    vma_attach_page(page, aux);
+    return true;
+}
+
+/* Creates the page at VA, which must be within V, in the current
+ * process's supplemental page table.  If LOAD is true, it is
+ * loaded from V on first access; otherwise, whoever first claims
+ * it must fill it in, as fork does from the parent's page.
+ * Returns true if successful, false on failure. */
+bool vma_alloc_page(struct vma* v, void* va, bool load) {
+    ASSERT(va >= v->start && va < v->end);
+
+    return vm_alloc_page_with_initializer(v->type, pg_round_down(va),
+                                          v->writable,
+                                          load ? vma_load_page : vma_keep_page,
+                                          v);
+}
+
+/* Whole address spaces. */
+
+/* Adds a copy of each VMA in the subtree at V to DST.  Returns
+ * true if successful, false if memory is short. */
+static bool copy_subtree(struct supplemental_page_table* dst,
+                         const struct vma* v) {
+    if (v == NULL) return true;
+    return vma_map(dst, v->start, (uint8_t*)v->end - (uint8_t*)v->start,
+                   v->writable, v->type, v->file, v->offset,
+                   v->read_bytes) != NULL &&
+           copy_subtree(dst, v->left) && copy_subtree(dst, v->right);
+}
+
+/* Adds a copy of each of SRC's VMAs to DST, which must be empty.
+ * Pages are not copied.  Returns true if successful, false if
+ * memory is short. */
+bool vma_copy_all(struct supplemental_page_table* dst,
+                  const struct supplemental_page_table* src) {
+    ASSERT(dst->vmas.root == NULL);
+
+    return copy_subtree(dst, src->vmas.root);
+}
+
+/* Frees the subtree of VMAs at V. */
+static void destroy_subtree(struct vma* v) {
+    if (v == NULL) return;
+    destroy_subtree(v->left);
+    destroy_subtree(v->right);
+    file_close(v->file);
+    kmem_cache_free(vma_cache, v);
+}
+
+/* Frees all of SPT's VMAs.  Their pages must already be gone. */
+void vma_destroy_all(struct supplemental_page_table* spt) {
+    destroy_subtree(spt->vmas.root);
+    vma_tree_init(&spt->vmas);
+}